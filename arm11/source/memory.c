@@ -30,21 +30,99 @@
 
 #include "memory.h"
 
+//The loops below must not be turned back into calls to memcpy/memset
+#pragma GCC optimize ("no-tree-loop-distribute-patterns")
+
+//Eight words per iteration, which GCC emits as one LDM/STM pair: a whole 32-byte cache line per burst
+static inline void copyLines(u32 *dest32, const u32 *src32, u32 lines)
+{
+    while(lines-- > 0)
+    {
+        u32 w0 = src32[0], w1 = src32[1], w2 = src32[2], w3 = src32[3],
+            w4 = src32[4], w5 = src32[5], w6 = src32[6], w7 = src32[7];
+
+        dest32[0] = w0; dest32[1] = w1; dest32[2] = w2; dest32[3] = w3;
+        dest32[4] = w4; dest32[5] = w5; dest32[6] = w6; dest32[7] = w7;
+        dest32 += 8;
+        src32 += 8;
+    }
+}
+
 void memcpy(void *dest, const void *src, u32 size)
 {
     u8 *destc = (u8 *)dest;
     const u8 *srcc = (const u8 *)src;
 
-    for(u32 i = 0; i < size; i++)
-        destc[i] = srcc[i];
+    //Short copies aren't worth aligning
+    if(size >= 8)
+    {
+        while(((uintptr_t)destc & 3) != 0)
+        {
+            *destc++ = *srcc++;
+            size--;
+        }
+
+        u32 *dest32 = (u32 *)destc;
+        u32 shift = ((uintptr_t)srcc & 3) * 8;
+
+        if(shift == 0)
+        {
+            const u32 *src32 = (const u32 *)srcc;
+
+            copyLines(dest32, src32, size / 32);
+            dest32 += size / 32 * 8;
+            src32 += size / 32 * 8;
+            for(u32 i = 0; i < (size & 31) / 4; i++) *dest32++ = *src32++;
+        }
+        else
+        {
+            //Source and destination disagree on alignment: read aligned words and merge neighbours.
+            //The last word read is the one holding the last byte copied, so nothing past it is touched.
+            const u32 *src32 = (const u32 *)(srcc - shift / 8);
+            u32 current = *src32++;
+
+            for(u32 i = 0; i < size / 4; i++)
+            {
+                u32 next = *src32++;
+                *dest32++ = current >> shift | next << (32 - shift);
+                current = next;
+            }
+        }
+
+        destc = (u8 *)dest32;
+        srcc += size & ~3;
+        size &= 3;
+    }
+
+    while(size-- > 0) *destc++ = *srcc++;
 }
 
 void memset(void *dest, u32 filler, u32 size)
 {
     u8 *destc = (u8 *)dest;
 
-    for(u32 i = 0; i < size; i++)
-        destc[i] = (u8)filler;
+    if(size >= 8)
+    {
+        while(((uintptr_t)destc & 3) != 0)
+        {
+            *destc++ = (u8)filler;
+            size--;
+        }
+
+        u32 word = (u8)filler * 0x01010101u, *dest32 = (u32 *)destc;
+
+        for(u32 i = 0; i < size / 32; i++, dest32 += 8)
+        {
+            dest32[0] = word; dest32[1] = word; dest32[2] = word; dest32[3] = word;
+            dest32[4] = word; dest32[5] = word; dest32[6] = word; dest32[7] = word;
+        }
+        for(u32 i = 0; i < (size & 31) / 4; i++) *dest32++ = word;
+
+        destc = (u8 *)dest32;
+        size &= 3;
+    }
+
+    while(size-- > 0) *destc++ = (u8)filler;
 }
 
 void memset32(void *dest, u32 filler, u32 size)
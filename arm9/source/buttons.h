@@ -28,7 +28,12 @@
 
 #include "types.h"
 
+#ifdef HOST_BUILD
+extern u32 hostHidPad;
+#define HID_PAD                hostHidPad
+#else
 #define HID_PAD                (*(vu32 *)0x10146000 ^ 0xFFF)
+#endif
 
 #define BUTTON_R1              (1 << 8)
 #define BUTTON_L1              (1 << 9)
@@ -46,4 +51,5 @@
 #define DPAD_BUTTONS           (BUTTON_LEFT | BUTTON_RIGHT | BUTTON_UP | BUTTON_DOWN)
 #define SINGLE_PAYLOAD_BUTTONS (BUTTON_B | BUTTON_X | BUTTON_Y)
 #define L_PAYLOAD_BUTTONS      (BUTTON_R1 | BUTTON_A | BUTTON_START | BUTTON_SELECT)
-#define MENU_BUTTONS           (DPAD_BUTTONS | BUTTON_A | BUTTON_START)
\ No newline at end of file
+#define MENU_BUTTONS           (DPAD_BUTTONS | BUTTON_A | BUTTON_START)
+#define PERF_OVERLAY_BUTTONS   BUTTON_SELECT
\ No newline at end of file
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "types.h"
+
+// Data cache maintenance by address range (32-byte lines), for memory shared with DMA.
+// Lines only partly inside the range are affected as a whole.
+
+// Writes dirty lines back, e.g. before a DMA engine reads the range
+void cleanDCacheRange(const void *start, u32 size);
+// Writes dirty lines back and drops them, e.g. before a DMA engine writes the range
+void flushDCacheRange(const void *start, u32 size);
+// Drops lines without writing them back, e.g. after a DMA engine wrote the range
+void invalidateDCacheRange(const void *start, u32 size);
@@ -0,0 +1,24 @@
+@ ARM946E-S data cache maintenance by modified virtual address, see cache.h.
+
+.macro rangeOp name, crm
+.section .text.\name, "ax", %progbits
+.arm
+.align 2
+.global \name
+.type   \name, %function
+\name:
+    add r1, r0, r1
+    bic r0, r0, #31
+1:
+    cmp r0, r1
+    mcrlo p15, 0, r0, c7, \crm, 1
+    addlo r0, r0, #32
+    blo 1b
+    mov r0, #0
+    mcr p15, 0, r0, c7, c10, 4  @ drain write buffer
+    bx lr
+.endm
+
+rangeOp cleanDCacheRange, c10
+rangeOp flushDCacheRange, c14
+rangeOp invalidateDCacheRange, c6
@@ -27,40 +27,63 @@
 #include "chainloader.h"
 #include "screen.h"
 #include "utils.h"
+#include "lz4.h"
+#include "ndma.h"
+
+#define SECTION_DMA_CHANNEL 1
 
 void disableMpuAndJumpToEntrypoints(int argc, char **argv, void *arm11Entry, void *arm9Entry);
 
 #pragma GCC optimize (3)
+// xmemmove's byte loops must stay loops, a memmove call would land in the main image being overwritten
+#pragma GCC optimize ("no-tree-loop-distribute-patterns")
 
-static void *xmemcpy(void *dst, const void *src, u32 len)
+//Backwards when the destination is above an overlapping source, so planned in-place moves work
+static void *xmemmove(void *dst, const void *src, u32 len)
 {
     const u8 *src8 = (const u8 *)src;
     u8 *dst8 = (u8 *)dst;
 
-    for (u32 i = 0; i < len; i++) {
-        dst8[i] = src8[i];
+    if (dst8 > src8 && dst8 < src8 + len) {
+        for (u32 i = len; i != 0; i--) {
+            dst8[i - 1] = src8[i - 1];
+        }
+    } else {
+        for (u32 i = 0; i < len; i++) {
+            dst8[i] = src8[i];
+        }
     }
 
     return dst;
 }
 
-static void doLaunchFirm(Firm *firm, int argc, char **argv)
+static void doLaunchFirm(const FirmLoadPlan *plan, int argc, char **argv)
 {
-    //Copy FIRM sections to respective memory locations
-    for(u32 sectionNum = 0; sectionNum < 4; sectionNum++)
-        xmemcpy(firm->section[sectionNum].address, (u8 *)firm + firm->section[sectionNum].offset, firm->section[sectionNum].size);
+    //Copy FIRM sections to respective memory locations, in the order loadHomebrewFirm planned
+    for(u32 i = 0; i < plan->count; i++)
+    {
+        const PlanStep *step = &plan->steps[i];
 
-    disableMpuAndJumpToEntrypoints(argc, argv, firm->arm9Entry, firm->arm11Entry);
+        if(step->op == PLAN_LZ4)
+            lz4Decompress((u8 *)step->dst, step->size, (const u8 *)step->src, step->srcSize);
+        else if(!ndmaCopy(SECTION_DMA_CHANNEL, (void *)step->dst, (const void *)step->src, step->size))
+            xmemmove((void *)step->dst, (const void *)step->src, step->size); //unaligned, overlapping or in TCM
+    }
+
+    disableMpuAndJumpToEntrypoints(argc, argv, (void *)plan->arm9Entry, (void *)plan->arm11Entry);
 
     __builtin_unreachable();
 }
 
-void chainloader_main(int argc, char **argv, Firm *firm)
+void chainloader_main(int argc, char **argv, const FirmLoadPlan *firmPlan)
 {
-    mcuSetInfoLedPattern(255, 255, 0, 0, false);
     char *argvPassed[2],
          absPath[24 + 255];
     struct fb fbs[2];
+    FirmLoadPlan plan;
+
+    //The original may be in the way of a section. A struct assignment this large may become a memcpy call.
+    xmemmove(&plan, firmPlan, sizeof(plan));
 
     if(argc > 0)
     {
@@ -81,6 +104,6 @@ void chainloader_main(int argc, char **argv, Firm *firm)
 
         argvPassed[1] = (char *)&fbs;
     }
-    mcuSetInfoLedPattern(255, 255, 255, 0, false);
-    doLaunchFirm(firm, argc, argvPassed);
+    ndmaInit();
+    doLaunchFirm(&plan, argc, argvPassed);
 }
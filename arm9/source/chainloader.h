@@ -27,6 +27,6 @@
 #pragma once
 
 #include "types.h"
-#include "firm.h"
+#include "firmplan.h"
 
-void chainload(int argc, char **argv, Firm *firm);
+void chainload(int argc, char **argv, const FirmLoadPlan *plan);
@@ -7,14 +7,102 @@
 /* storage control modules to the FatFs module with a defined API.       */
 /*-----------------------------------------------------------------------*/
 
+#include <string.h>
 #include "ff.h"			/* Obtains integer types */
 #include "diskio.h"		/* Declarations of disk functions */
 #include "sdmmc/sdmmc.h"
 #include "../i2c.h"
+#include "../trace.h"
+#include "../timer.h"
 
 /* Definitions of physical drive number for each drive */
 #define SDCARD        0
 
+/* Write-back cache: single sector writes are held here, sorted by LBA, and
+   programmed on CTRL_SYNC (f_sync/f_close) with adjacent sectors merged into
+   one multi-block write */
+#define WCACHE_SECTORS 8
+
+static BYTE wcacheData[WCACHE_SECTORS][FF_MAX_SS] __attribute__((aligned(4)));
+static LBA_t wcacheSector[WCACHE_SECTORS];
+static UINT wcacheCount;
+
+/* Write protect switch, sampled once per mount */
+static bool sdWritable;
+
+// From GodMode9
+#define BCDVALID(b) (((b)<=0x99)&&(((b)&0xF)<=0x9)&&((((b)>>4)&0xF)<=0x9))
+#define BCD2NUM(b)  (BCDVALID(b) ? (((b)&0xF)+((((b)>>4)&0xF)*10)) : 0xFF)
+#define NUM2BCD(n)  ((n<99) ? (((n/10)*0x10)|(n%10)) : 0x99)
+#define DSTIMEGET(bcd,n) (BCD2NUM((bcd)->n))
+
+// see: http://3dbrew.org/wiki/I2C_Registers#Device_3 (register 30)
+typedef struct DsTime {
+    u8 bcd_s;
+    u8 bcd_m;
+    u8 bcd_h;
+    u8 weekday;
+    u8 bcd_D;
+    u8 bcd_M;
+    u8 bcd_Y;
+    u8 leap_count;
+} DsTime;
+
+/* MCU clock, read once per mount: timestamps are that time plus the timer ticks since.
+   Seconds count from 2000-01-01 00:00:00, the MCU's epoch. */
+static DsTime rtcTime;
+static I2cTransfer rtcTransfer;
+static u32 rtcSeconds;
+static u64 rtcTicks;
+
+static const u16 daysBeforeMonth[12] = { 0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334 };
+
+/* Every fourth year is a leap year from 2000 to 2099, which is all the MCU counts */
+static u32 rtcToSeconds(const DsTime *time)
+{
+    u32 s = DSTIMEGET(time, bcd_s), m = DSTIMEGET(time, bcd_m), h = DSTIMEGET(time, bcd_h),
+        D = DSTIMEGET(time, bcd_D), M = DSTIMEGET(time, bcd_M), Y = DSTIMEGET(time, bcd_Y);
+
+    if(s > 59 || m > 59 || h > 23 || D < 1 || D > 31 || M < 1 || M > 12 || Y > 99) return 0;
+
+    u32 days = Y * 365 + (Y + 3) / 4 + daysBeforeMonth[M - 1] + (M > 2 && Y % 4 == 0) + D - 1;
+
+    return ((days * 24 + h) * 60 + m) * 60 + s;
+}
+
+static DWORD secondsToFatTime(u32 seconds)
+{
+    u32 days = seconds / 86400, daySeconds = seconds % 86400, year = 0, month = 0;
+
+    while(days >= (year % 4 == 0 ? 366u : 365u)) days -= year++ % 4 == 0 ? 366 : 365;
+
+    bool isLeap = year % 4 == 0;
+    while(month < 11 && days >= daysBeforeMonth[month + 1] + (isLeap && month + 1 >= 2 ? 1u : 0u)) month++;
+    days -= daysBeforeMonth[month] + (isLeap && month >= 2);
+
+    return ((daySeconds % 60) >> 1) |
+           ((daySeconds / 60 % 60) << 5) |
+           ((daySeconds / 3600) << 11) |
+           ((days + 1) << 16) |
+           ((month + 1) << 21) |
+           ((year + 2000 - 1980) << 25);
+}
+
+/* Read in flight between disk_read_start() and disk_read_wait() */
+static BYTE *asyncBuff;
+static LBA_t asyncSector;
+static UINT asyncCount;
+
+/* Sectors still in the write cache are newer than what is on the card */
+static void readFromWriteCache(BYTE *buff, LBA_t sector, UINT count)
+{
+    for(UINT i = 0; i < wcacheCount; i++)
+    {
+        if(wcacheSector[i] >= sector && wcacheSector[i] - sector < count)
+            memcpy(buff + (wcacheSector[i] - sector) * FF_MAX_SS, wcacheData[i], FF_MAX_SS);
+    }
+}
+
 /*-----------------------------------------------------------------------*/
 /* Get Drive Status                                                      */
 /*-----------------------------------------------------------------------*/
@@ -41,7 +129,17 @@ DSTATUS disk_initialize (
     DSTATUS res = 0;
 
     if(sdmmcInitResult == 4)
+    {
+        // Queued ahead of the card init; with I2C_USE_IRQ the read runs meanwhile
+        I2C_readRegBufAsync(&rtcTransfer, I2C_DEV_MCU, 0x30, (u8 *)&rtcTime, sizeof(DsTime));
+
         sdmmcInitResult = sdmmc_sdcard_init();
+        traceStage(STAGE_SD_INIT);
+
+        // Well within the 2 second resolution of FAT timestamps even if the read finished early
+        rtcSeconds = I2C_wait(&rtcTransfer) ? rtcToSeconds(&rtcTime) : 0;
+        rtcTicks = timerTicks();
+    }
 
     // Check physical drive initialized status
     switch (pdrv)
@@ -54,6 +152,8 @@ DSTATUS disk_initialize (
             break;
     }
 
+    sdWritable = res == 0 && sdmmc_sdcard_writable();
+
     return res;
 }
 
@@ -75,7 +175,17 @@ DRESULT disk_read (
     switch (pdrv)
     {
         case SDCARD:
-            res = sdmmc_sdcard_readsectors(sector, count, buff) == 0 ? RES_OK : RES_PARERR;
+            bootTrace.readCalls++;
+            bootTrace.sectorsRead += count;
+
+            // One command moves at most SDMMC_MAX_BLOCKS sectors (exFAT clusters can be larger)
+            for(UINT done = 0, n; res == RES_OK && done < count; done += n)
+            {
+                n = count - done > SDMMC_MAX_BLOCKS ? SDMMC_MAX_BLOCKS : count - done;
+                res = sdmmc_sdcard_readsectors(sector + done, n, buff + done * FF_MAX_SS) == 0 ? RES_OK : RES_ERROR;
+            }
+
+            if(res == RES_OK) readFromWriteCache(buff, sector, count);
             break;
         default:
             res = RES_NOTRDY;
@@ -87,12 +197,112 @@ DRESULT disk_read (
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Split read: start, do other work, wait (not used by FatFs)            */
+/*-----------------------------------------------------------------------*/
+
+DRESULT disk_read_start (
+    BYTE pdrv,		/* Physical drive nmuber to identify the drive */
+    BYTE *buff,		/* Data buffer to store read data */
+    LBA_t sector,	/* Start sector in LBA */
+    UINT count		/* Number of sectors to read, up to SDMMC_MAX_BLOCKS */
+)
+{
+    if(pdrv != SDCARD) return RES_NOTRDY;
+    if(count == 0 || count > SDMMC_MAX_BLOCKS) return RES_PARERR;
+
+    bootTrace.readCalls++;
+    bootTrace.sectorsRead += count;
+
+    asyncBuff = buff;
+    asyncSector = sector;
+    asyncCount = count;
+    sdmmc_sdcard_readsectors_start(sector, count, buff);
+
+    return RES_OK;
+}
+
+DRESULT disk_read_wait (
+    BYTE pdrv		/* Physical drive nmuber to identify the drive */
+)
+{
+    if(pdrv != SDCARD) return RES_NOTRDY;
+    if(sdmmc_sdcard_readsectors_wait() != 0) return RES_ERROR;
+
+    readFromWriteCache(asyncBuff, asyncSector, asyncCount);
+
+    return RES_OK;
+}
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Write Sector(s)                                                       */
 /*-----------------------------------------------------------------------*/
 
 #if FF_FS_READONLY == 0
 
+static DRESULT writeSectors(LBA_t sector, UINT count, const BYTE *buff)
+{
+    DRESULT res = RES_OK;
+
+    bootTrace.writeCalls++;
+    bootTrace.sectorsWritten += count;
+
+    for(UINT done = 0, n; res == RES_OK && done < count; done += n)
+    {
+        n = count - done > SDMMC_MAX_BLOCKS ? SDMMC_MAX_BLOCKS : count - done;
+        res = sdmmc_sdcard_writesectors(sector + done, n, buff + done * FF_MAX_SS) == 0 ? RES_OK : RES_ERROR;
+    }
+
+    return res;
+}
+
+static DRESULT flushWriteCache(void)
+{
+    DRESULT res = RES_OK;
+
+    for(UINT i = 0; i < wcacheCount;)
+    {
+        UINT run = 1;
+        while(i + run < wcacheCount && wcacheSector[i + run] == wcacheSector[i] + run) run++;
+
+        if(writeSectors(wcacheSector[i], run, wcacheData[i]) != RES_OK) res = RES_ERROR;
+        i += run;
+    }
+
+    wcacheCount = 0;
+    return res;
+}
+
+static DRESULT cacheWrite(LBA_t sector, const BYTE *buff)
+{
+    UINT i = 0;
+    while(i < wcacheCount && wcacheSector[i] < sector) i++;
+
+    if(i < wcacheCount && wcacheSector[i] == sector)
+    {
+        bootTrace.writeCacheHits++;
+        memcpy(wcacheData[i], buff, FF_MAX_SS);
+        return RES_OK;
+    }
+
+    if(wcacheCount == WCACHE_SECTORS)
+    {
+        DRESULT res = flushWriteCache();
+        if(res != RES_OK) return res;
+        i = 0;
+    }
+
+    memmove(wcacheData[i + 1], wcacheData[i], (wcacheCount - i) * FF_MAX_SS);
+    memmove(&wcacheSector[i + 1], &wcacheSector[i], (wcacheCount - i) * sizeof(LBA_t));
+    memcpy(wcacheData[i], buff, FF_MAX_SS);
+    wcacheSector[i] = sector;
+    wcacheCount++;
+
+    return RES_OK;
+}
+
 DRESULT disk_write (
     BYTE pdrv,			/* Physical drive nmuber to identify the drive */
     const BYTE *buff,	/* Data to be written */
@@ -106,10 +316,16 @@ DRESULT disk_write (
     {
         case SDCARD:
         {
-            if ((*(vu16 *)(SDMMC_BASE + REG_SDSTATUS0) & TMIO_STAT0_WRPROTECT) == 0) // why == 0?
+            if (!sdWritable)
                 res = RES_WRPRT;
+            else if (count == 1)
+                res = cacheWrite(sector, buff);
             else
-                res = sdmmc_sdcard_writesectors(sector, count, buff) == 0 ? RES_OK : RES_PARERR;
+            {
+                // Keep the card in program order: older cached sectors go first
+                res = flushWriteCache();
+                if (res == RES_OK) res = writeSectors(sector, count, buff);
+            }
             break;
         }
         default:
@@ -132,43 +348,43 @@ DRESULT disk_ioctl (
     void *buff		/* Buffer to send/receive control data */
 )
 {
-    (void)pdrv;
-    (void)buff;
-    return cmd == CTRL_SYNC ? RES_OK : RES_PARERR;
-}
+    if(pdrv != SDCARD) return RES_PARERR;
 
-// From GodMode9
-#define BCDVALID(b) (((b)<=0x99)&&(((b)&0xF)<=0x9)&&((((b)>>4)&0xF)<=0x9))
-#define BCD2NUM(b)  (BCDVALID(b) ? (((b)&0xF)+((((b)>>4)&0xF)*10)) : 0xFF)
-#define NUM2BCD(n)  ((n<99) ? (((n/10)*0x10)|(n%10)) : 0x99)
-#define DSTIMEGET(bcd,n) (BCD2NUM((bcd)->n))
+    switch(cmd)
+    {
+        case CTRL_SYNC:
+#if FF_FS_READONLY == 0
+            return flushWriteCache();
+#else
+            return RES_OK;
+#endif
+        case GET_SECTOR_COUNT:
+            *(LBA_t *)buff = sdmmc_sdcard_sectors();
+            return RES_OK;
+        case GET_BLOCK_SIZE:
+            *(DWORD *)buff = sdmmc_sdcard_ausize();
+            return RES_OK;
+#if FF_USE_TRIM
+        case CTRL_TRIM:
+        {
+            const LBA_t *range = (const LBA_t *)buff;
 
-// see: http://3dbrew.org/wiki/I2C_Registers#Device_3 (register 30)
-typedef struct DsTime {
-    u8 bcd_s;
-    u8 bcd_m;
-    u8 bcd_h;
-    u8 weekday;
-    u8 bcd_D;
-    u8 bcd_M;
-    u8 bcd_Y;
-    u8 leap_count;
-} DsTime;
+            if(!sdWritable) return RES_WRPRT;
+            // Cached writes may target the range, keep them ahead of the erase
+            if(flushWriteCache() != RES_OK) return RES_ERROR;
+            return sdmmc_sdcard_erase(range[0], range[1]) == 0 ? RES_OK : RES_ERROR;
+        }
+#endif
+        default:
+            return RES_PARERR;
+    }
+}
 
 /*-----------------------------------------------------------------------*/
 /* Get current FAT time                                                  */
 /*-----------------------------------------------------------------------*/
 
+/* No I2C traffic: the clock read at mount plus the time elapsed since */
 DWORD get_fattime( void ) {
-    DsTime dstime;
-    I2C_readRegBuf(I2C_DEV_MCU, 0x30, (u8 *)&dstime, sizeof(DsTime));
-    DWORD fattime =
-        ((DSTIMEGET(&dstime, bcd_s)&0x3F) >> 1 ) |
-        ((DSTIMEGET(&dstime, bcd_m)&0x3F) << 5 ) |
-        ((DSTIMEGET(&dstime, bcd_h)&0x3F) << 11) |
-        ((DSTIMEGET(&dstime, bcd_D)&0x1F) << 16) |
-        ((DSTIMEGET(&dstime, bcd_M)&0x0F) << 21) |
-        (((DSTIMEGET(&dstime, bcd_Y)+(2000-1980))&0x7F) << 25);
-
-    return fattime;
+    return secondsToFatTime(rtcSeconds + (u32)(timerTicksToMs(timerTicks() - rtcTicks) / 1000));
 }
@@ -31,6 +31,8 @@ DSTATUS disk_status (BYTE pdrv);
 DRESULT disk_read (BYTE pdrv, BYTE* buff, LBA_t sector, UINT count);
 DRESULT disk_write (BYTE pdrv, const BYTE* buff, LBA_t sector, UINT count);
 DRESULT disk_ioctl (BYTE pdrv, BYTE cmd, void* buff);
+DRESULT disk_read_start (BYTE pdrv, BYTE* buff, LBA_t sector, UINT count);
+DRESULT disk_read_wait (BYTE pdrv);
 
 
 /* Disk Status Bits (DSTATUS) */
@@ -1,5 +0,0 @@
-#pragma once
-
-#include "../../types.h"
-
-void waitcycles(u32 us);
@@ -23,10 +23,36 @@
  */
 
 #include "sdmmc.h"
-#include "delay.h"
+#include "../../timer.h"
+#ifdef SDMMC_USE_IRQ
+#include "../../irq.h"
+#endif
 
 static struct mmcdevice handleSD;
+static struct sdmmcstats stats;
+static u32 auSectors = 1; //erase unit (AU_SIZE from the SD status), 1 if unknown
 
+#ifdef SDMMC_REG_HOOKS
+static inline u16 sdmmc_read16(u16 reg)
+{
+    return sdmmc_hook_read16(reg);
+}
+
+static inline void sdmmc_write16(u16 reg, u16 val)
+{
+    sdmmc_hook_write16(reg, val);
+}
+
+static inline u32 sdmmc_read32(u16 reg)
+{
+    return sdmmc_hook_read32(reg);
+}
+
+static inline void sdmmc_write32(u16 reg, u32 val)
+{
+    sdmmc_hook_write32(reg, val);
+}
+#else
 static inline u16 sdmmc_read16(u16 reg)
 {
     return *(vu16 *)(SDMMC_BASE + reg);
@@ -46,6 +72,7 @@ static inline void sdmmc_write32(u16 reg, u32 val)
 {
     *(vu32 *)(SDMMC_BASE + reg) = val;
 }
+#endif
 
 static inline void sdmmc_mask16(u16 reg, const u16 clear, const u16 set)
 {
@@ -75,123 +102,226 @@ static void inittarget(struct mmcdevice *ctx)
     else sdmmc_mask16(REG_SDOPT, 0x8000, 0);
 }
 
-static void __attribute__((noinline)) sdmmc_send_command(struct mmcdevice *ctx, u32 cmd, u32 args)
+//The command in flight, advanced by serviceCommand()
+static struct
 {
-    u32 getSDRESP = (cmd << 15) >> 31;
-    u16 flags = (cmd << 15) >> 31;
-    const int readdata = cmd & 0x20000;
-    const int writedata = cmd & 0x40000;
-
-    if(readdata || writedata)
-        flags |= TMIO_STAT0_DATAEND;
+    struct mmcdevice *ctx;
+    u32 cmd;
+    u32 size;
+    u8 *rDataPtr;
+    const u8 *tDataPtr;
+    u16 flags;
+    u16 status0;
+    volatile bool done;
+} cur;
+
+static void startCommand(struct mmcdevice *ctx, u32 cmd, u32 args)
+{
+    cur.ctx = ctx;
+    cur.cmd = cmd;
+    cur.flags = (cmd << 15) >> 31;
+    if(cmd & 0x60000) cur.flags |= TMIO_STAT0_DATAEND;
+    cur.size = ctx->size;
+    cur.rDataPtr = ctx->rData;
+    cur.tDataPtr = ctx->tData;
+    cur.status0 = 0;
+    cur.done = false;
 
     ctx->error = 0;
+    stats.commands++;
     while((sdmmc_read16(REG_SDSTATUS1) & TMIO_STAT1_CMD_BUSY)); //mmc working?
+#ifdef SDMMC_USE_IRQ
+    //Data commands complete by interrupt: FIFO blocks, DATAEND and errors
+    if(cmd & 0x60000)
+    {
+        sdmmc_write16(REG_SDIRMASK0, (u16)~TMIO_STAT0_DATAEND);
+        sdmmc_write16(REG_SDIRMASK1, (u16)~TMIO_MASK_GW);
+    }
+    else
+    {
+        sdmmc_write16(REG_SDIRMASK0, 0xFFFF);
+        sdmmc_write16(REG_SDIRMASK1, 0xFFFF);
+    }
+#else
     sdmmc_write16(REG_SDIRMASK0, 0);
     sdmmc_write16(REG_SDIRMASK1, 0);
+#endif
     sdmmc_write16(REG_SDSTATUS0, 0);
     sdmmc_write16(REG_SDSTATUS1, 0);
     sdmmc_mask16(REG_DATACTL32, 0x1800, 0);
+#ifdef SDMMC_USE_IRQ
+    if(cmd & 0x20000) sdmmc_mask16(REG_DATACTL32, 0, 0x800); //RX32RDY interrupt
+    if(cmd & 0x40000) sdmmc_mask16(REG_DATACTL32, 0, 0x1000); //TX32RQ interrupt
+#endif
     sdmmc_write16(REG_SDCMDARG0, args & 0xFFFF);
     sdmmc_write16(REG_SDCMDARG1, args >> 16);
     sdmmc_write16(REG_SDCMD, cmd & 0xFFFF);
+}
+
+static void finishCommand(void)
+{
+    struct mmcdevice *ctx = cur.ctx;
 
-    u32 size = ctx->size;
-    u8 *rDataPtr = ctx->rData;
-    const u8 *tDataPtr = ctx->tData;
+    ctx->size = cur.size; //what is left untransferred, for resuming after an error
+    ctx->stat0 = sdmmc_read16(REG_SDSTATUS0);
+    ctx->stat1 = sdmmc_read16(REG_SDSTATUS1);
+    sdmmc_write16(REG_SDSTATUS0, 0);
+    sdmmc_write16(REG_SDSTATUS1, 0);
+#ifdef SDMMC_USE_IRQ
+    sdmmc_mask16(REG_DATACTL32, 0x1800, 0);
+    sdmmc_write16(REG_SDIRMASK0, 0xFFFF);
+    sdmmc_write16(REG_SDIRMASK1, 0xFFFF);
+#endif
+
+    if(ctx->error & 4)
+    {
+        stats.errors++;
+        stats.lasterror = ctx->error;
+        stats.laststat1 = ctx->stat1;
+        stats.lastcmd = (u16)cur.cmd;
+    }
 
-    bool rUseBuf = rDataPtr != NULL;
-    bool tUseBuf = tDataPtr != NULL;
+    if((cur.cmd << 15) >> 31)
+    {
+        ctx->ret[0] = (u32)(sdmmc_read16(REG_SDRESP0) | (sdmmc_read16(REG_SDRESP1) << 16));
+        ctx->ret[1] = (u32)(sdmmc_read16(REG_SDRESP2) | (sdmmc_read16(REG_SDRESP3) << 16));
+        ctx->ret[2] = (u32)(sdmmc_read16(REG_SDRESP4) | (sdmmc_read16(REG_SDRESP5) << 16));
+        ctx->ret[3] = (u32)(sdmmc_read16(REG_SDRESP6) | (sdmmc_read16(REG_SDRESP7) << 16));
+    }
+
+    cur.done = true;
+}
+
+//One pass of the status loop: moves a FIFO block if one is ready, finishes the command once
+//the expected status bits (or an error) are in. Returns true when the command is done.
+static bool serviceCommand(void)
+{
+    struct mmcdevice *ctx = cur.ctx;
+    const u32 readdata = cur.cmd & 0x20000;
+    const u32 writedata = cur.cmd & 0x40000;
 
-    u16 status0 = 0;
-    while(true)
+    vu16 status1 = sdmmc_read16(REG_SDSTATUS1);
+    vu16 ctl32 = sdmmc_read16(REG_DATACTL32);
+    if((ctl32 & 0x100))
     {
-        vu16 status1 = sdmmc_read16(REG_SDSTATUS1);
-        vu16 ctl32 = sdmmc_read16(REG_DATACTL32);
-        if((ctl32 & 0x100))
+        if(readdata)
         {
-            if(readdata)
+            if(cur.rDataPtr != NULL)
             {
-                if(rUseBuf)
+                sdmmc_mask16(REG_SDSTATUS1, TMIO_STAT1_RXRDY, 0);
+                if(cur.size != 0)
                 {
-                    sdmmc_mask16(REG_SDSTATUS1, TMIO_STAT1_RXRDY, 0);
-                    if(size > 0x1FF)
+                    //Short blocks (e.g. the 64-byte SD status) are read whole
+                    u32 blockSize = cur.size < 0x200 ? cur.size : 0x200;
+                    u8 *rDataPtr = cur.rDataPtr;
+
+                    //Gabriel Marcano: This implementation doesn't assume alignment.
+                    //I've removed the alignment check doen with former rUseBuf32 as a result
+                    for(u32 i = 0; i < blockSize; i += 4)
                     {
-                        //Gabriel Marcano: This implementation doesn't assume alignment.
-                        //I've removed the alignment check doen with former rUseBuf32 as a result
-                        for(int i = 0; i < 0x200; i += 4)
-                        {
-                            u32 data = sdmmc_read32(REG_SDFIFO32);
-                            *rDataPtr++ = data;
-                            *rDataPtr++ = data >> 8;
-                            *rDataPtr++ = data >> 16;
-                            *rDataPtr++ = data >> 24;
-                        }
-                        size -= 0x200;
+                        u32 data = sdmmc_read32(REG_SDFIFO32);
+                        *rDataPtr++ = data;
+                        *rDataPtr++ = data >> 8;
+                        *rDataPtr++ = data >> 16;
+                        *rDataPtr++ = data >> 24;
                     }
+                    cur.rDataPtr = rDataPtr;
+                    cur.size -= blockSize;
                 }
-
-                sdmmc_mask16(REG_DATACTL32, 0x800, 0);
             }
+
+#ifndef SDMMC_USE_IRQ
+            sdmmc_mask16(REG_DATACTL32, 0x800, 0);
+#endif
         }
-        if(!(ctl32 & 0x200))
+    }
+    if(!(ctl32 & 0x200))
+    {
+        if(writedata)
         {
-            if(writedata)
+            if(cur.tDataPtr != NULL)
             {
-                if(tUseBuf)
+                sdmmc_mask16(REG_SDSTATUS1, TMIO_STAT1_TXRQ, 0);
+                if(cur.size > 0x1FF)
                 {
-                    sdmmc_mask16(REG_SDSTATUS1, TMIO_STAT1_TXRQ, 0);
-                    if(size > 0x1FF)
+                    const u8 *tDataPtr = cur.tDataPtr;
+
+                    for(int i = 0; i < 0x200; i += 4)
                     {
-                        for(int i = 0; i < 0x200; i += 4)
-                        {
-                            u32 data = *tDataPtr++;
-                            data |= (u32)*tDataPtr++ << 8;
-                            data |= (u32)*tDataPtr++ << 16;
-                            data |= (u32)*tDataPtr++ << 24;
-                            sdmmc_write32(REG_SDFIFO32, data);
-                        }
-                        size -= 0x200;
+                        u32 data = *tDataPtr++;
+                        data |= (u32)*tDataPtr++ << 8;
+                        data |= (u32)*tDataPtr++ << 16;
+                        data |= (u32)*tDataPtr++ << 24;
+                        sdmmc_write32(REG_SDFIFO32, data);
                     }
+                    cur.tDataPtr = tDataPtr;
+                    cur.size -= 0x200;
                 }
-
-                sdmmc_mask16(REG_DATACTL32, 0x1000, 0);
             }
+
+#ifndef SDMMC_USE_IRQ
+            sdmmc_mask16(REG_DATACTL32, 0x1000, 0);
+#endif
+        }
+    }
+    if(status1 & TMIO_MASK_GW)
+    {
+        ctx->error |= 4;
+        finishCommand();
+        return true;
+    }
+
+    if(!(status1 & TMIO_STAT1_CMD_BUSY))
+    {
+        cur.status0 |= sdmmc_read16(REG_SDSTATUS0);
+#ifdef SDMMC_USE_IRQ
+        //Acknowledged as they are seen, so a level-triggered line doesn't stay up until the end
+        sdmmc_write16(REG_SDSTATUS0, (u16)~cur.status0);
+#endif
+        if(cur.status0 & TMIO_STAT0_CMDRESPEND)
+        {
+            ctx->error |= 0x1;
         }
-        if(status1 & TMIO_MASK_GW)
+        if(cur.status0 & TMIO_STAT0_DATAEND)
         {
-            ctx->error |= 4;
-            break;
+            ctx->error |= 0x2;
         }
 
-        if(!(status1 & TMIO_STAT1_CMD_BUSY))
+        if((cur.status0 & cur.flags) == cur.flags)
         {
-            status0 = sdmmc_read16(REG_SDSTATUS0);
-            if(sdmmc_read16(REG_SDSTATUS0) & TMIO_STAT0_CMDRESPEND)
-            {
-                ctx->error |= 0x1;
-            }
-            if(status0 & TMIO_STAT0_DATAEND)
-            {
-                ctx->error |= 0x2;
-            }
-
-            if((status0 & flags) == flags)
-                break;
+            finishCommand();
+            return true;
         }
     }
-    ctx->stat0 = sdmmc_read16(REG_SDSTATUS0);
-    ctx->stat1 = sdmmc_read16(REG_SDSTATUS1);
-    sdmmc_write16(REG_SDSTATUS0, 0);
-    sdmmc_write16(REG_SDSTATUS1, 0);
 
-    if(getSDRESP != 0)
+    return false;
+}
+
+#ifdef SDMMC_USE_IRQ
+static void sdmmcIrqHandler(void)
+{
+    if(cur.ctx != NULL && !cur.done) serviceCommand();
+}
+#endif
+
+static void waitCommand(void)
+{
+#ifdef SDMMC_USE_IRQ
+    //The CPU sleeps through data transfers, short commands are still polled
+    if(cur.cmd & 0x60000)
     {
-        ctx->ret[0] = (u32)(sdmmc_read16(REG_SDRESP0) | (sdmmc_read16(REG_SDRESP1) << 16));
-        ctx->ret[1] = (u32)(sdmmc_read16(REG_SDRESP2) | (sdmmc_read16(REG_SDRESP3) << 16));
-        ctx->ret[2] = (u32)(sdmmc_read16(REG_SDRESP4) | (sdmmc_read16(REG_SDRESP5) << 16));
-        ctx->ret[3] = (u32)(sdmmc_read16(REG_SDRESP6) | (sdmmc_read16(REG_SDRESP7) << 16));
+        irqWaitFor(&cur.done);
+        return;
     }
+#endif
+
+    while(!serviceCommand());
+}
+
+static void __attribute__((noinline)) sdmmc_send_command(struct mmcdevice *ctx, u32 cmd, u32 args)
+{
+    startCommand(ctx, cmd, args);
+    waitCommand();
 }
 
 // Luma3DS_chainloader\arm9\source\fatfs\diskio.c\disk_write
@@ -199,6 +329,14 @@ int __attribute__((noinline)) sdmmc_sdcard_writesectors(u32 sector_no, u32 numse
 {
     if(handleSD.isSDHC == 0) sector_no <<= 9;
     inittarget(&handleSD);
+
+    //ACMD23 (SET_WR_BLK_ERASE_COUNT): lets the card pre-erase the whole range before CMD25
+    if(numsectors > 1)
+    {
+        sdmmc_send_command(&handleSD, 0x10437, handleSD.initarg << 0x10);
+        sdmmc_send_command(&handleSD, 0x10457, numsectors);
+    }
+
     sdmmc_write16(REG_SDSTOP, 0x100);
     sdmmc_write16(REG_SDBLKCOUNT32, numsectors);
     sdmmc_write16(REG_SDBLKLEN32, 0x200);
@@ -209,8 +347,7 @@ int __attribute__((noinline)) sdmmc_sdcard_writesectors(u32 sector_no, u32 numse
     return geterror(&handleSD);
 }
 
-// Luma3DS_chainloader\arm9\source\fatfs\diskio.c\disk_read
-int __attribute__((noinline)) sdmmc_sdcard_readsectors(u32 sector_no, u32 numsectors, u8 *out)
+static void startRead(u32 sector_no, u32 numsectors, u8 *out)
 {
     if(handleSD.isSDHC == 0) sector_no <<= 9;
     inittarget(&handleSD);
@@ -220,10 +357,171 @@ int __attribute__((noinline)) sdmmc_sdcard_readsectors(u32 sector_no, u32 numsec
     sdmmc_write16(REG_SDBLKCOUNT, numsectors);
     handleSD.rData = out;
     handleSD.size = numsectors << 9;
-    sdmmc_send_command(&handleSD, 0x33C12, sector_no);
+    startCommand(&handleSD, 0x33C12, sector_no);
+}
+
+static int readSectorsOnce(u32 sector_no, u32 numsectors, u8 *out)
+{
+    startRead(sector_no, numsectors, out);
+    waitCommand();
     return geterror(&handleSD);
 }
 
+//Halves the SD clock after a CRC error, down to HCLK/512
+static void stepDownClock(void)
+{
+    u32 div = handleSD.clk & 0xFF;
+    if(div == 0x80) return;
+
+    handleSD.clk = (handleSD.clk & ~0xFFu) | (div == 0 ? 1 : div << 1);
+    stats.slowdowns++;
+}
+
+static int SD_Init();
+static void InitSD();
+
+//Resets the controller and brings the card back up, keeping a clock that was stepped down
+static int reinitCard(void)
+{
+    u32 clk = handleSD.clk;
+
+    stats.reinits++;
+    InitSD();
+    if(SD_Init() != 0) return -1;
+
+    if((clk & 0xFF) > (handleSD.clk & 0xFF)) handleSD.clk = clk;
+
+    return 0;
+}
+
+//Read started by sdmmc_sdcard_readsectors_start(), kept for recovery in the wait call
+static struct
+{
+    u32 sector_no;
+    u32 numsectors;
+    u8 *out;
+} asyncRead;
+
+//Starts a read and returns while it is in flight. With SDMMC_USE_IRQ the interrupt handler moves
+//the data meanwhile; when polling, the blocks only move in sdmmc_sdcard_readsectors_wait().
+//No other command may be issued until that wait.
+void sdmmc_sdcard_readsectors_start(u32 sector_no, u32 numsectors, u8 *out)
+{
+    asyncRead.sector_no = sector_no;
+    asyncRead.numsectors = numsectors;
+    asyncRead.out = out;
+    startRead(sector_no, numsectors, out);
+}
+
+//Retries a failed read until it succeeds or a sector has failed too often
+static int recoverRead(u32 sector_no, u32 numsectors, u8 *out, int ret)
+{
+    u32 retry = 0;
+
+    while(ret != 0)
+    {
+        //Resume where the transfer stopped. The last block received is read again,
+        //its CRC failure may only have been flagged after it was drained from the FIFO.
+        u32 done = ((numsectors << 9) - handleSD.size) >> 9;
+        if(done != 0) done--;
+        sector_no += done;
+        numsectors -= done;
+        out += done << 9;
+
+        //Retries are bounded per failing sector, a transfer that made progress starts over
+        if(done != 0) retry = 0;
+        if(retry++ == SDMMC_READ_RETRIES) return ret;
+        stats.retries++;
+
+        if(handleSD.stat1 & TMIO_STAT1_CRCFAIL) stepDownClock();
+
+        //The last attempt comes after a full controller and card re-init
+        if(retry == SDMMC_READ_RETRIES)
+        {
+            if(reinitCard() != 0) return ret;
+        }
+        else sdmmc_send_command(&handleSD, 0x1050C, 0); //CMD12, back to the tran state
+
+        ret = readSectorsOnce(sector_no, numsectors, out);
+    }
+
+    return 0;
+}
+
+//A failed read started asynchronously goes through the same recovery as a blocking one
+int sdmmc_sdcard_readsectors_wait(void)
+{
+    waitCommand();
+
+    return recoverRead(asyncRead.sector_no, asyncRead.numsectors, asyncRead.out, geterror(&handleSD));
+}
+
+// Luma3DS_chainloader\arm9\source\fatfs\diskio.c\disk_read
+int __attribute__((noinline)) sdmmc_sdcard_readsectors(u32 sector_no, u32 numsectors, u8 *out)
+{
+    return recoverRead(sector_no, numsectors, out, readSectorsOnce(sector_no, numsectors, out));
+}
+
+//Erases sectors start..end inclusive (CMD32/CMD33/CMD38) and waits for the card to be ready again
+int sdmmc_sdcard_erase(u32 start, u32 end)
+{
+    if(handleSD.isSDHC == 0)
+    {
+        start <<= 9;
+        end <<= 9;
+    }
+    inittarget(&handleSD);
+
+    sdmmc_send_command(&handleSD, 0x10420, start);
+    if(handleSD.error & 0x4) return geterror(&handleSD);
+    sdmmc_send_command(&handleSD, 0x10421, end);
+    if(handleSD.error & 0x4) return geterror(&handleSD);
+    sdmmc_send_command(&handleSD, 0x10526, 0);
+    if(handleSD.error & 0x4) return geterror(&handleSD);
+
+    //CMD13 until READY_FOR_DATA in the tran state, giving up on a card that stays busy
+    u64 deadline = timerDeadlineMs(SDMMC_ERASE_TIMEOUT_MS);
+    do
+    {
+        sdmmc_send_command(&handleSD, 0x1040D, handleSD.initarg << 0x10);
+        if(handleSD.error & 0x4) return geterror(&handleSD);
+        if((handleSD.ret[0] & 0x1F00) != 0x900 && timerExpired(deadline)) return -1;
+    }
+    while((handleSD.ret[0] & 0x1F00) != 0x900);
+
+    return 0;
+}
+
+//AU_SIZE (SD status bits 431:428) to sectors; 0 means not defined
+static u32 calcAUSectors(u32 auSize)
+{
+    static const u32 largeAU[] = {16384, 24576, 32768, 49152, 65536, 131072}; //8, 12, 16, 24, 32, 64 MiB
+
+    if(auSize == 0) return 1;
+    return auSize < 0xA ? 32u << (auSize - 1) : largeAU[auSize - 0xA];
+}
+
+//ACMD13: 64-byte SD status, read as a single short block
+static void readSDStatus(void)
+{
+    u32 status[16];
+
+    sdmmc_send_command(&handleSD, 0x10437, handleSD.initarg << 0x10);
+    if(handleSD.error & 0x4) return;
+
+    sdmmc_write16(REG_SDBLKLEN, 64);
+    sdmmc_write16(REG_SDBLKLEN32, 64);
+    sdmmc_write16(REG_SDBLKCOUNT32, 1);
+    sdmmc_write16(REG_SDBLKCOUNT, 1);
+    handleSD.rData = (u8 *)status;
+    handleSD.size = sizeof(status);
+    sdmmc_send_command(&handleSD, 0x31C4D, 0);
+    handleSD.rData = NULL;
+    sdmmc_write16(REG_SDBLKLEN, 512);
+
+    if(!(handleSD.error & 0x4)) auSectors = calcAUSectors(((u8 *)status)[10] >> 4);
+}
+
 static u32 calcSDSize(u8 *csd, int type)
 {
     u32 result = 0;
@@ -248,6 +546,13 @@ static u32 calcSDSize(u8 *csd, int type)
             result = (result << 8) | csd[5];
             result = (result + 1) * 1024;
             break;
+        case 2: //CSD v3 (SDUC): 28-bit C_SIZE, clamped to what a 32-bit sector number can address
+        {
+            u64 size = (u64)(csd[8] & 0xF) << 24 | (u32)csd[7] << 16 | (u32)csd[6] << 8 | csd[5];
+            size = (size + 1) * 1024;
+            result = size > 0xFFFFFFFFULL ? 0xFFFFFFFF : (u32)size;
+            break;
+        }
         default:
             break; //Do nothing otherwise FIXME perhaps return some error?
     }
@@ -256,28 +561,30 @@ static u32 calcSDSize(u8 *csd, int type)
 
 static void InitSD()
 {
+#ifndef SDMMC_REG_HOOKS
     *(vu32 *)0x10000020 = 0; //InitFS stuff
     *(vu32 *)0x10000020 = 0x200; //InitFS stuff
-    *(vu16 *)0x10006100 &= 0xF7FFu; //SDDATACTL32
-    *(vu16 *)0x10006100 &= 0xEFFFu; //SDDATACTL32
-    *(vu16 *)0x10006100 |= 0x402u; //SDDATACTL32
-    *(vu16 *)0x100060D8 = (*(vu16 *)0x100060D8 & 0xFFDD) | 2;
-    *(vu16 *)0x10006100 &= 0xFFFFu; //SDDATACTL32
-    *(vu16 *)0x100060D8 &= 0xFFDFu; //SDDATACTL
-    *(vu16 *)0x10006104 = 512; //SDBLKLEN32
-    *(vu16 *)0x10006108 = 1; //SDBLKCOUNT32
-    *(vu16 *)0x100060E0 &= 0xFFFEu; //SDRESET
-    *(vu16 *)0x100060E0 |= 1u; //SDRESET
-    *(vu16 *)0x10006020 |= TMIO_MASK_ALL; //SDIR_MASK0
-    *(vu16 *)0x10006022 |= TMIO_MASK_ALL>>16; //SDIR_MASK1
-    *(vu16 *)0x100060FC |= 0xDBu; //SDCTL_RESERVED7
-    *(vu16 *)0x100060FE |= 0xDBu; //SDCTL_RESERVED8
-    *(vu16 *)0x10006002 &= 0xFFFCu; //SDPORTSEL
-    *(vu16 *)0x10006024 = 0x20;
-    *(vu16 *)0x10006028 = 0x40EE;
-    *(vu16 *)0x10006002 &= 0xFFFCu; ////SDPORTSEL
-    *(vu16 *)0x10006026 = 512; //SDBLKLEN
-    *(vu16 *)0x10006008 = 0; //SDSTOP
+#endif
+    sdmmc_mask16(REG_DATACTL32, 0x800, 0);
+    sdmmc_mask16(REG_DATACTL32, 0x1000, 0);
+    sdmmc_mask16(REG_DATACTL32, 0, 0x402);
+    sdmmc_mask16(REG_DATACTL, 0x22, 2);
+    sdmmc_mask16(REG_DATACTL32, 0, 0);
+    sdmmc_mask16(REG_DATACTL, 0x20, 0);
+    sdmmc_write16(REG_SDBLKLEN32, 512);
+    sdmmc_write16(REG_SDBLKCOUNT32, 1);
+    sdmmc_mask16(REG_SDRESET, 1, 0);
+    sdmmc_mask16(REG_SDRESET, 0, 1);
+    sdmmc_mask16(REG_SDIRMASK0, 0, TMIO_MASK_ALL & 0xFFFF);
+    sdmmc_mask16(REG_SDIRMASK1, 0, TMIO_MASK_ALL >> 16);
+    sdmmc_mask16(0xFC, 0, 0xDB); //SDCTL_RESERVED7
+    sdmmc_mask16(0xFE, 0, 0xDB); //SDCTL_RESERVED8
+    sdmmc_mask16(REG_SDPORTSEL, 3, 0);
+    sdmmc_write16(REG_SDCLKCTL, 0x20);
+    sdmmc_write16(REG_SDOPT, 0x40EE);
+    sdmmc_mask16(REG_SDPORTSEL, 3, 0);
+    sdmmc_write16(REG_SDBLKLEN, 512);
+    sdmmc_write16(REG_SDSTOP, 0);
 }
 
 static int SD_Init()
@@ -292,10 +599,10 @@ static int SD_Init()
 
     inittarget(&handleSD);
 
-    waitcycles(1u << 22); //Card needs a little bit of time to be detected, it seems FIXME test again to see what a good number is for the delay
+    timerWaitMs(SDMMC_DETECT_DELAY_MS); //Card needs a little bit of time to be detected, it seems FIXME test again to see what a good number is for the delay
 
     //If not inserted
-    if(!(*((vu16 *)(SDMMC_BASE + REG_SDSTATUS0)) & TMIO_STAT0_SIGSTATE)) return 5;
+    if(!(sdmmc_read16(REG_SDSTATUS0) & TMIO_STAT0_SIGSTATE)) return 5;
 
     sdmmc_send_command(&handleSD, 0, 0);
     sdmmc_send_command(&handleSD, 0x10408, 0x1AA);
@@ -350,13 +657,52 @@ static int SD_Init()
     if((handleSD.error & 0x4)) return -8;
     handleSD.clk |= 0x200;
 
+    readSDStatus();
+
     return 0;
 }
 
+const sdmmcstats *sdmmc_get_stats(void)
+{
+    return &stats;
+}
+
+//The controller reports the write protect switch as set when writing is allowed
+bool sdmmc_sdcard_writable(void)
+{
+    return (sdmmc_read16(REG_SDSTATUS0) & TMIO_STAT0_WRPROTECT) != 0;
+}
+
+//SD clock in Hz, from the divider selected in SDCLKCTL (0 = /2, 1 << n = /(4 << n))
+u32 sdmmc_sdcard_clock(void)
+{
+    u32 div = handleSD.clk & 0xFF;
+    return SDMMC_CLOCK / (div == 0 ? 2 : div * 4);
+}
+
+u32 sdmmc_sdcard_buswidth(void)
+{
+    return handleSD.SDOPT == 0 ? 1 : 4;
+}
+
+u32 sdmmc_sdcard_sectors(void)
+{
+    return handleSD.total_size;
+}
+
+u32 sdmmc_sdcard_ausize(void)
+{
+    return auSectors;
+}
+
 // Luma3DS_chainloader\arm9\source\fatfs\diskio.c\disk_initialize
 u32 sdmmc_sdcard_init()
 {
     u32 ret = 0;
+#ifdef SDMMC_USE_IRQ
+    irqInit();
+    irqRegister(IRQ_SDIO_1, sdmmcIrqHandler);
+#endif
     InitSD(); 
     if(SD_Init() != 0) ret = 2;
     return ret;
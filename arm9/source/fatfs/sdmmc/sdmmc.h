@@ -3,6 +3,11 @@
 #include "../../types.h"
 
 #define SDMMC_BASE		0x10006000
+#define SDMMC_CLOCK		67027964 //controller base clock in Hz
+#define SDMMC_MAX_BLOCKS	0xFFFF //REG_SDBLKCOUNT is 16-bit
+#define SDMMC_READ_RETRIES	3 //the last one after re-initializing the controller and card
+#define SDMMC_DETECT_DELAY_MS	250 //about what the old 1 << 22 iteration spin took at 134 MHz
+#define SDMMC_ERASE_TIMEOUT_MS	5000 //card busy after CMD38, well above what cards report for a TRIM
 
 #define REG_SDCMD		0x00
 #define REG_SDPORTSEL		0x02
@@ -91,6 +96,34 @@ typedef struct mmcdevice {
     u32 res;
 } mmcdevice;
 
+typedef struct sdmmcstats {
+    u32 commands;
+    u32 errors;
+    u32 lasterror;
+    u16 laststat1;
+    u16 lastcmd;
+    u32 retries;   //read attempts repeated after an error
+    u32 reinits;   //controller and card re-initializations
+    u32 slowdowns; //clock step-downs after CRC errors
+} sdmmcstats;
+
+#ifdef SDMMC_REG_HOOKS
+//Register accesses go through these instead of MMIO (e.g. to the host-side TMIO simulator)
+u16 sdmmc_hook_read16(u16 reg);
+void sdmmc_hook_write16(u16 reg, u16 val);
+u32 sdmmc_hook_read32(u16 reg);
+void sdmmc_hook_write32(u16 reg, u32 val);
+#endif
+
 u32 sdmmc_sdcard_init();
 int sdmmc_sdcard_readsectors(u32 sector_no, u32 numsectors, u8 *out);
-int sdmmc_sdcard_writesectors(u32 sector_no, u32 numsectors, const u8 *in);
\ No newline at end of file
+void sdmmc_sdcard_readsectors_start(u32 sector_no, u32 numsectors, u8 *out);
+int sdmmc_sdcard_readsectors_wait(void);
+int sdmmc_sdcard_writesectors(u32 sector_no, u32 numsectors, const u8 *in);
+int sdmmc_sdcard_erase(u32 start, u32 end);
+bool sdmmc_sdcard_writable(void);
+const sdmmcstats *sdmmc_get_stats(void);
+u32 sdmmc_sdcard_clock(void);
+u32 sdmmc_sdcard_buswidth(void);
+u32 sdmmc_sdcard_sectors(void);
+u32 sdmmc_sdcard_ausize(void);
\ No newline at end of file
@@ -4,13 +4,220 @@
 #include "chainloader.h"
 #include "utils.h"
 #include "fmt.h"
+#include "trace.h"
+#include "memory.h"
+#include "lz4.h"
+#include "i2c.h"
+#if defined(SDMMC_USE_IRQ) || defined(I2C_USE_IRQ)
+#include "irq.h"
+#endif
+
+#define STAGING_END     0x27FFE000
+#define FCRAM_START     0x20000000
 
 static Firm *firm = (Firm *)0x20001000;
+static FirmLoadPlan loadPlan;
+
+// Where the stored data of each section is once read, and whether it was read straight to its load address
+static u32 stagedAddress[4];
+static bool isPlacedDirectly[4];
 
 void launchFirm(int argc, char **argv)
 {
     prepareArm11ForFirmlaunch();
-    chainload(argc, argv, firm);
+    chainload(argc, argv, &loadPlan);
+}
+
+static inline u32 toAddress(const void *ptr)
+{
+    return (u32)(uintptr_t)ptr;
+}
+
+static inline bool rangesOverlap(u32 start1, u32 size1, u32 start2, u32 size2)
+{
+    return (u64)start1 < (u64)start2 + size2 && (u64)start2 < (u64)start1 + size1;
+}
+
+// Checks the header alone, before the rest of the file is read: the magic, that the section data is inside
+// the file and not shared, and that no section is copied over another or over memory still in use
+// (firmReservedRanges). Both entry points must be inside a section. Overlaps with the staged file are left to planFirmLoad().
+static bool checkFirmHeader(u32 payloadSize)
+{
+    if(memcmp(firm->magic, "FIRM", 4) != 0 || payloadSize <= FIRM_HEADER_SIZE) return false;
+
+    bool isPacked = (firm->reserved2[0] & FIRM_FLAG_LZ4) != 0,
+         arm9EntryFound = false,
+         arm11EntryFound = false;
+
+    for(u32 sectionNum = 0; sectionNum < 4; sectionNum++)
+    {
+        const FirmSection *section = &firm->section[sectionNum];
+        u32 storedSize = isPacked ? firmPackedSize(firm, sectionNum) : section->size,
+            address = toAddress(section->address);
+
+        // Empty sections are never read or decoded, so they must not claim any stored data either
+        if(section->size == 0)
+        {
+            if(storedSize != 0) return false;
+            continue;
+        }
+
+        if(section->offset < FIRM_HEADER_SIZE || section->offset > payloadSize || storedSize > payloadSize - section->offset)
+            return false;
+        if(!firmSectionAllowed(address, section->size)) return false;
+
+        for(u32 i = 0; i < sectionNum; i++)
+        {
+            const FirmSection *other = &firm->section[i];
+            if(other->size == 0) continue;
+
+            if(rangesOverlap(address, section->size, toAddress(other->address), other->size) ||
+               rangesOverlap(section->offset, storedSize, other->offset, isPacked ? firmPackedSize(firm, i) : other->size))
+                return false;
+        }
+
+        arm9EntryFound |= toAddress(firm->arm9Entry) - address < section->size;
+        arm11EntryFound |= toAddress(firm->arm11Entry) - address < section->size;
+    }
+
+    return arm9EntryFound && arm11EntryFound;
+}
+
+static inline u32 storedSize(u32 sectionNum)
+{
+    return (firm->reserved2[0] & FIRM_FLAG_LZ4) != 0 ? firmPackedSize(firm, sectionNum) : firm->section[sectionNum].size;
+}
+
+// The whole file is read to the staging window, each section's data stays at its file offset
+static void layoutStagedFirm(void)
+{
+    for(u32 sectionNum = 0; sectionNum < 4; sectionNum++)
+    {
+        stagedAddress[sectionNum] = toAddress(firm) + firm->section[sectionNum].offset;
+        isPlacedDirectly[sectionNum] = false;
+    }
+}
+
+// For payloads larger than the staging window: plain sections bound for FCRAM the loader doesn't use
+// are read straight to their load address; the rest is staged after the header. Only that part has to
+// fit the window. Returns false if it doesn't.
+static bool layoutScatteredFirm(void)
+{
+    static const MemRange directWindow = { FCRAM_START, STAGING_END };
+    bool isPacked = (firm->reserved2[0] & FIRM_FLAG_LZ4) != 0,
+         isChanged;
+    u32 stagingEnd;
+
+    for(u32 sectionNum = 0; sectionNum < 4; sectionNum++)
+    {
+        const FirmSection *section = &firm->section[sectionNum];
+        u32 address = toAddress(section->address);
+
+        isPlacedDirectly[sectionNum] = !isPacked && section->size != 0 && memRangeContains(directWindow, address, section->size);
+    }
+
+    // Sections in the way of the staged data are staged too, which may push the staged data further
+    do
+    {
+        isChanged = false;
+        stagingEnd = toAddress(firm) + FIRM_HEADER_SIZE;
+
+        for(u32 sectionNum = 0; sectionNum < 4; sectionNum++)
+        {
+            if(isPlacedDirectly[sectionNum]) continue;
+
+            u32 size = storedSize(sectionNum);
+            if(size > STAGING_END - stagingEnd) return false;
+
+            stagedAddress[sectionNum] = stagingEnd;
+            stagingEnd += (size + FIRM_HEADER_SIZE - 1) & ~(FIRM_HEADER_SIZE - 1);
+        }
+
+        for(u32 sectionNum = 0; sectionNum < 4; sectionNum++)
+        {
+            if(isPlacedDirectly[sectionNum] &&
+               rangesOverlap(toAddress(firm->section[sectionNum].address), firm->section[sectionNum].size,
+                             toAddress(firm), stagingEnd - toAddress(firm)))
+            {
+                isPlacedDirectly[sectionNum] = false;
+                isChanged = true;
+            }
+        }
+    }
+    while(isChanged);
+
+    for(u32 sectionNum = 0; sectionNum < 4; sectionNum++)
+        if(isPlacedDirectly[sectionNum]) stagedAddress[sectionNum] = toAddress(firm->section[sectionNum].address);
+
+    return true;
+}
+
+// Sections may be copied over the staged data, as long as what they cover has been consumed by then.
+// Sections already in place only have to be kept clear of.
+static bool planFirmLoad(void)
+{
+    PlanSection sections[4];
+    MemRange avoid[FIRM_RESERVED_COUNT + 4];
+    u32 count = 0, avoidCount = 0;
+
+    for(u32 i = 0; i < FIRM_RESERVED_COUNT; i++) avoid[avoidCount++] = firmReservedRanges[i];
+
+    for(u32 sectionNum = 0; sectionNum < 4; sectionNum++)
+    {
+        const FirmSection *section = &firm->section[sectionNum];
+
+        if(isPlacedDirectly[sectionNum])
+        {
+            avoid[avoidCount].start = toAddress(section->address);
+            avoid[avoidCount++].end = toAddress(section->address) + section->size;
+            continue;
+        }
+
+        sections[count].dst = toAddress(section->address);
+        sections[count].size = section->size;
+        sections[count].src = stagedAddress[sectionNum];
+        sections[count].srcSize = storedSize(sectionNum);
+        sections[count++].isPacked = (firm->reserved2[0] & FIRM_FLAG_LZ4) != 0;
+    }
+
+    loadPlan.arm9Entry = toAddress(firm->arm9Entry);
+    loadPlan.arm11Entry = toAddress(firm->arm11Entry);
+
+    MemRange bounceWindow = { toAddress(firm), STAGING_END };
+    return planSectionLoads(&loadPlan, sections, count, bounceWindow, avoid, avoidCount);
+}
+
+static bool readScatteredFirm(const char *path)
+{
+    FileExtent extents[4];
+    u32 count = 0;
+
+    for(u32 sectionNum = 0; sectionNum < 4; sectionNum++)
+    {
+        if(firm->section[sectionNum].size == 0) continue;
+
+        extents[count].dest = (void *)stagedAddress[sectionNum];
+        extents[count].offset = firm->section[sectionNum].offset;
+        extents[count++].size = storedSize(sectionNum);
+    }
+
+    return fileReadExtents(path, extents, count);
+}
+
+// The chainloader decodes without bounds checks of its own, so every block (inside the file,
+// see checkFirmHeader) must decode to exactly the section size
+static bool checkPackedSections(void)
+{
+    for(u32 sectionNum = 0; sectionNum < 4; sectionNum++)
+    {
+        const FirmSection *section = &firm->section[sectionNum];
+
+        if(section->size == 0) continue;
+        if(lz4Decompress(NULL, section->size, (const u8 *)stagedAddress[sectionNum], firmPackedSize(firm, sectionNum)) != section->size)
+            return false;
+    }
+
+    return true;
 }
 
 void loadHomebrewFirm()
@@ -19,17 +226,39 @@ void loadHomebrewFirm()
     
     if(!payloadMenu(path)) return;
 
-    u32 maxPayloadSize = (u32)((u8 *)0x27FFE000 - (u8 *)firm);
-    u32 payloadSize = fileRead(firm, path, maxPayloadSize);
+    u32 maxPayloadSize = (u32)((u8 *)STAGING_END - (u8 *)firm);
+
+    // A bad payload is turned down after one sector, not after reading all of it
+    u32 payloadSize = fileReadHead(firm, path, FIRM_HEADER_SIZE);
+    if(!checkFirmHeader(payloadSize)) error("The payload is invalid or corrupted.");
+
+    bool isScattered = payloadSize > maxPayloadSize;
+    if(!isScattered) layoutStagedFirm();
+    else if(!layoutScatteredFirm()) error("The payload is too large.");
+    if(!planFirmLoad()) error("The payload's sections can't be loaded safely.");
+
+    bool isRead = isScattered ? readScatteredFirm(path) : fileRead(firm, path, maxPayloadSize) == payloadSize;
+    if(!isRead) error("The payload is invalid or corrupted.");
+    traceStage(STAGE_READ);
 
-    if(payloadSize <= 0x200) error("The payload is invalid or corrupted.");
+    if((firm->reserved2[0] & FIRM_FLAG_LZ4) != 0 && !checkPackedSections())
+        error("The payload is invalid or corrupted.");
     
     char absPath[24 + 255];
 
-    sprintf(absPath, "sdmc:/luma/%s", path);
+    snprintf(absPath, sizeof(absPath), "sdmc:/luma/%s", path);
 
     char *argv[2] = {absPath, (char *)fbs};
-    bool wantsScreenInit = (firm->reserved2[0] & 1) != 0;
-        
+    bool wantsScreenInit = (firm->reserved2[0] & FIRM_FLAG_SCREEN_INIT) != 0;
+
+    traceStage(STAGE_LAUNCH);
+    mcuSetInfoLedPattern(255, 255, 255, 0, false); //queued, sent while the boot log is written
+    writeBootLog();
+
+    I2C_flush(); //queued MCU writes land before the payload owns the bus
+#if defined(SDMMC_USE_IRQ) || defined(I2C_USE_IRQ)
+    irqDeinit(); //payloads expect interrupts masked, as the boot ROM leaves them
+#endif
+
     launchFirm(wantsScreenInit ? 2 : 1, argv);
 }
\ No newline at end of file
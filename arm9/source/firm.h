@@ -28,4 +28,16 @@
 #include "types.h"
 #include "3dsheaders.h"
 
+#define FIRM_HEADER_SIZE        0x200 //Firm plus its RSA signature, section data starts after it
+
+// reserved2[0] flags
+#define FIRM_FLAG_SCREEN_INIT   1
+#define FIRM_FLAG_LZ4           2 //sections are LZ4 blocks, section[i].size being the decoded size
+
+// With FIRM_FLAG_LZ4, the encoded size of each section is stored at reserved2 + 0x10
+static inline u32 firmPackedSize(const Firm *firm, u32 sectionNum)
+{
+    return ((const u32 *)(firm->reserved2 + 0x10))[sectionNum];
+}
+
 void loadHomebrewFirm();
@@ -0,0 +1,158 @@
+/*
+*   Load order planner for FIRM sections. It works on plain addresses, so it
+*   runs unchanged in the host fuzzer (host/source/planfuzz.c).
+*/
+
+#include "firmplan.h"
+
+#define BOUNCE_ALIGN    32
+
+// The chainloader has left the loader's main image and stack by then, but its own ITCM slice (code, data,
+// stack) is live, and so is the ARM11 firmlaunch stub spinning on the entry word at the end of AXI WRAM.
+// The operation mailbox at 0x1FF80004 is not reserved: the ARM11 is done with it once it has reported
+// ready, and ARM11 sections usually load right over it, at 0x1FF80000.
+const MemRange firmReservedRanges[FIRM_RESERVED_COUNT] = {
+    { 0x01FF8000, 0x01FFB800 },
+    { 0x1FFFFC00, 0x20000000 },
+};
+
+static inline bool overlaps(u32 start1, u32 size1, u32 start2, u32 size2)
+{
+    return size1 != 0 && size2 != 0 && (u64)start1 < (u64)start2 + size2 && (u64)start2 < (u64)start1 + size1;
+}
+
+bool firmSectionAllowed(u32 address, u32 size)
+{
+    if(address + size < address) return false;
+
+    for(u32 i = 0; i < FIRM_RESERVED_COUNT; i++)
+        if(overlaps(address, size, firmReservedRanges[i].start, firmReservedRanges[i].end - firmReservedRanges[i].start))
+            return false;
+
+    return true;
+}
+
+bool memRangeContains(MemRange range, u32 start, u32 size)
+{
+    return start >= range.start && start < range.end && size <= range.end - start;
+}
+
+static void addStep(FirmLoadPlan *plan, u32 op, u32 dst, u32 size, u32 src, u32 srcSize)
+{
+    PlanStep *step = &plan->steps[plan->count++];
+
+    step->op = op;
+    step->dst = dst;
+    step->size = size;
+    step->src = src;
+    step->srcSize = srcSize;
+}
+
+static bool isFree(u32 start, u32 size, const PlanSection *sections, u32 count, const MemRange *avoid, u32 avoidCount,
+                   const FirmLoadPlan *plan)
+{
+    for(u32 i = 0; i < count; i++)
+        if(overlaps(start, size, sections[i].dst, sections[i].size) || overlaps(start, size, sections[i].src, sections[i].srcSize))
+            return false;
+
+    for(u32 i = 0; i < avoidCount; i++)
+        if(overlaps(start, size, avoid[i].start, avoid[i].end - avoid[i].start)) return false;
+
+    //Earlier bounce copies
+    for(u32 i = 0; i < plan->count; i++)
+        if(overlaps(start, size, plan->steps[i].dst, plan->steps[i].size)) return false;
+
+    return true;
+}
+
+// Lowest aligned spot in the window that is clear of everything; a gap always starts at the window
+// start or right after one of the ranges in the way
+static bool findBounce(u32 *bounce, u32 size, MemRange window, const PlanSection *sections, u32 count,
+                       const MemRange *avoid, u32 avoidCount, const FirmLoadPlan *plan)
+{
+    u32 candidates[1 + 2 * 4 + 8 + FIRM_PLAN_MAX_STEPS], numCandidates = 0;
+    bool found = false;
+
+    if(count > 4 || avoidCount > 8) return false;
+
+    candidates[numCandidates++] = window.start;
+    for(u32 i = 0; i < count; i++)
+    {
+        candidates[numCandidates++] = sections[i].dst + sections[i].size;
+        candidates[numCandidates++] = sections[i].src + sections[i].srcSize;
+    }
+    for(u32 i = 0; i < avoidCount; i++) candidates[numCandidates++] = avoid[i].end;
+    for(u32 i = 0; i < plan->count; i++) candidates[numCandidates++] = plan->steps[i].dst + plan->steps[i].size;
+
+    for(u32 i = 0; i < numCandidates; i++)
+    {
+        u64 start = ((u64)candidates[i] + BOUNCE_ALIGN - 1) & ~(u64)(BOUNCE_ALIGN - 1);
+
+        if(start < window.start || start + size > window.end || (found && start >= *bounce)) continue;
+        if(!isFree((u32)start, size, sections, count, avoid, avoidCount, plan)) continue;
+
+        *bounce = (u32)start;
+        found = true;
+    }
+
+    return found;
+}
+
+bool planSectionLoads(FirmLoadPlan *plan, const PlanSection *sections, u32 count,
+                      MemRange bounceWindow, const MemRange *avoid, u32 avoidCount)
+{
+    u32 src[4];
+    bool isDone[4];
+    u32 left = 0;
+
+    if(count > 4) return false;
+
+    plan->count = 0;
+    for(u32 i = 0; i < count; i++)
+    {
+        src[i] = sections[i].src;
+        isDone[i] = sections[i].size == 0;
+        if(!isDone[i]) left++;
+    }
+
+    while(left != 0)
+    {
+        bool progress = false;
+
+        for(u32 i = 0; i < count; i++)
+        {
+            if(isDone[i]) continue;
+
+            //Writing section i must not clobber data still to be read, including its own packed data
+            bool isReady = !sections[i].isPacked || !overlaps(sections[i].dst, sections[i].size, src[i], sections[i].srcSize);
+            for(u32 j = 0; isReady && j < count; j++)
+                if(j != i && !isDone[j] && overlaps(sections[i].dst, sections[i].size, src[j], sections[j].srcSize)) isReady = false;
+
+            if(!isReady) continue;
+
+            addStep(plan, sections[i].isPacked ? PLAN_LZ4 : PLAN_COPY, sections[i].dst, sections[i].size, src[i],
+                    sections[i].isPacked ? sections[i].srcSize : sections[i].size);
+            isDone[i] = true;
+            left--;
+            progress = true;
+        }
+
+        if(progress) continue;
+
+        //Stuck: move the smallest pending source out of the way
+        u32 victim = count;
+        for(u32 i = 0; i < count; i++)
+            if(!isDone[i] && src[i] == sections[i].src && (victim == count || sections[i].srcSize < sections[victim].srcSize))
+                victim = i;
+
+        u32 bounce = 0;
+        if(victim == count || plan->count + left + 1 > FIRM_PLAN_MAX_STEPS ||
+           !findBounce(&bounce, sections[victim].srcSize, bounceWindow, sections, count, avoid, avoidCount, plan))
+            return false;
+
+        addStep(plan, PLAN_COPY, bounce, sections[victim].srcSize, src[victim], sections[victim].srcSize);
+        src[victim] = bounce;
+    }
+
+    return true;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "types.h"
+
+#define FIRM_PLAN_MAX_STEPS     8 //one per section, plus a bounce copy for each
+#define FIRM_RESERVED_COUNT     2
+
+typedef struct
+{
+    u32 start, end;
+} MemRange;
+
+typedef enum
+{
+    PLAN_COPY = 0, //memmove semantics, dst and src may overlap
+    PLAN_LZ4,      //decode srcSize bytes at src into size bytes at dst, which must not overlap
+} PlanOp;
+
+typedef struct
+{
+    u32 op;
+    u32 dst, size;
+    u32 src, srcSize;
+} PlanStep;
+
+// Everything the chainloader needs once it starts overwriting memory, so it can keep a copy on its own stack
+typedef struct
+{
+    u32 arm9Entry, arm11Entry;
+    u32 count;
+    PlanStep steps[FIRM_PLAN_MAX_STEPS];
+} FirmLoadPlan;
+
+typedef struct
+{
+    u32 dst, size;    //destination and size once loaded
+    u32 src, srcSize; //stored data, possibly LZ4 packed
+    bool isPacked;
+} PlanSection;
+
+// Memory still in use while the chainloader copies the sections
+extern const MemRange firmReservedRanges[FIRM_RESERVED_COUNT];
+
+// Whether a section of size bytes at address neither wraps around nor touches firmReservedRanges
+bool firmSectionAllowed(u32 address, u32 size);
+
+// Whether [start, start + size) lies inside range, without wrapping for starts at or past its end
+bool memRangeContains(MemRange range, u32 start, u32 size);
+
+// Orders the section loads so that no destination is written before every stored section data it overlaps
+// has been consumed. Sections that can't be ordered (overlap cycles, or packed data overlapping its own
+// destination) are first copied to a bounce area inside bounceWindow, clear of every source, destination
+// and avoid range. Destinations must not overlap each other. Returns false if there is no room to bounce.
+bool planSectionLoads(FirmLoadPlan *plan, const PlanSection *sections, u32 count,
+                      MemRange bounceWindow, const MemRange *avoid, u32 avoidCount);
@@ -81,16 +81,68 @@ static s32 skipAtoi(const char **s)
     return i;
 }
 
-static char *processNumber(char *str, s64 num, bool isHex, s32 size, s32 precision, u32 type)
+//Where formatted characters go: only the first capacity of them are stored, all are counted
+typedef struct
+{
+    char *buf;
+    u32 capacity;
+    u32 count;
+} Output;
+
+static inline void put(Output *out, char c)
+{
+    if(out->count < out->capacity) out->buf[out->count] = c;
+    out->count++;
+}
+
+static inline void putRepeated(Output *out, char c, s32 n)
+{
+    while(n-- > 0) put(out, c);
+}
+
+//Digits in reverse. Values over 32 bits are split nine digits at a time with one 64-bit division each,
+//everything else divides in 32 bits, which the compiler does by multiplication instead of calling libgcc
+static u32 decimalDigits(char *tmp, u64 num)
+{
+    u32 i = 0;
+
+    while(num > 0xFFFFFFFFULL)
+    {
+        u64 quotient = num / 1000000000;
+        u32 rest = (u32)(num - quotient * 1000000000);
+
+        for(u32 j = 0; j < 9; j++, rest /= 10) tmp[i++] = '0' + rest % 10;
+        num = quotient;
+    }
+
+    for(u32 n = (u32)num; n != 0; n /= 10) tmp[i++] = '0' + n % 10;
+
+    return i;
+}
+
+static u32 hexDigits(char *tmp, u64 num, const char *dig)
+{
+    u32 i = 0;
+
+    for(u32 n = (u32)num, high = (u32)(num >> 32); n != 0 || high != 0; i++)
+    {
+        tmp[i] = dig[n & 0xF];
+        n = n >> 4 | high << 28;
+        high >>= 4;
+    }
+
+    return i;
+}
+
+static void processNumber(Output *out, u64 num, bool isNegative, bool isHex, s32 size, s32 precision, u32 type)
 {
     char sign = 0;
 
     if(type & SIGN)
     {
-        if(num < 0)
+        if(isNegative)
         {
             sign = '-';
-            num = -num;
             size--;
         }
         else if(type & PLUS)
@@ -117,46 +169,34 @@ static char *processNumber(char *str, s64 num, bool isHex, s32 size, s32 precisi
         if(precision != 0) tmp[i++] = '0';
         type &= ~HEX_PREP;
     }
-    else
-    {
-        while(num != 0)
-        {
-            u64 base = isHex ? 16ULL : 10ULL;
-            tmp[i++] = dig[(u64)num % base];
-            num = (s64)((u64)num / base);
-        }
-    }
+    else i = (s32)(isHex ? hexDigits(tmp, num, dig) : decimalDigits(tmp, num));
 
     if(type & LEFT || precision != -1) type &= ~ZEROPAD;
     if(type & HEX_PREP && isHex) size -= 2;
     if(i > precision) precision = i;
     size -= precision;
-    if(!(type & (ZEROPAD | LEFT))) while(size-- > 0) *str++ = ' ';
-    if(sign) *str++ = sign;
+    if(!(type & (ZEROPAD | LEFT))) putRepeated(out, ' ', size);
+    if(sign) put(out, sign);
 
     if(type & HEX_PREP && isHex)
     {
-        *str++ = '0';
-        *str++ = 'x';
+        put(out, '0');
+        put(out, (type & UPPERCASE) ? 'X' : 'x');
     }
 
-    if(type & ZEROPAD) while(size-- > 0) *str++ = '0';
-    while(i < precision--) *str++ = '0';
-    while(i-- > 0) *str++ = tmp[i];
-    while(size-- > 0) *str++ = ' ';
-
-    return str;
+    if(type & ZEROPAD) putRepeated(out, '0', size);
+    putRepeated(out, '0', precision - i);
+    while(i-- > 0) put(out, tmp[i]);
+    if(type & LEFT) putRepeated(out, ' ', size);
 }
 
-int vsprintf(char *buf, const char *fmt, va_list args)
+static void format(Output *out, const char *fmt, va_list args)
 {
-    char *str;
-
-    for(str = buf; *fmt; fmt++)
+    for(; *fmt; fmt++)
     {
         if(*fmt != '%')
         {
-            *str++ = *fmt;
+            put(out, *fmt);
             continue;
         }
 
@@ -203,10 +243,12 @@ int vsprintf(char *buf, const char *fmt, va_list args)
             else if(*fmt == '*')
             {
                 fmt++;
+
+                //A negative precision argument counts as none given
                 precision = va_arg(args, s32);
+                if(precision < 0) precision = -1;
             }
-
-            if(precision < 0) precision = 0;
+            else precision = 0;
         }
 
         //Get the conversion qualifier
@@ -235,19 +277,19 @@ int vsprintf(char *buf, const char *fmt, va_list args)
         switch(*fmt)
         {
             case 'c':
-                if(!(flags & LEFT)) while(--fieldWidth > 0) *str++ = ' ';
-                *str++ = (u8)va_arg(args, s32);
-                while(--fieldWidth > 0) *str++ = ' ';
+                if(!(flags & LEFT)) putRepeated(out, ' ', fieldWidth - 1);
+                put(out, (char)va_arg(args, s32));
+                if(flags & LEFT) putRepeated(out, ' ', fieldWidth - 1);
                 continue;
 
             case 's':
             {
-                char *s = va_arg(args, char *);
-                if(!s) s = "<NULL>";
-                u32 len = (precision != -1) ? strnlen(s, precision) : strlen(s);
-                if(!(flags & LEFT)) while((s32)len < fieldWidth--) *str++ = ' ';
-                for(u32 i = 0; i < len; i++) *str++ = *s++;
-                while((s32)len < fieldWidth--) *str++ = ' ';
+                const char *s = va_arg(args, char *);
+                if(!s) s = "(null)";
+                s32 len = (s32)((precision != -1) ? strnlen(s, precision) : strlen(s));
+                if(!(flags & LEFT)) putRepeated(out, ' ', fieldWidth - len);
+                for(s32 i = 0; i < len; i++) put(out, s[i]);
+                if(flags & LEFT) putRepeated(out, ' ', fieldWidth - len);
                 continue;
             }
 
@@ -257,7 +299,7 @@ int vsprintf(char *buf, const char *fmt, va_list args)
                     fieldWidth = 8;
                     flags |= ZEROPAD;
                 }
-                str = processNumber(str, va_arg(args, u32), true, fieldWidth, precision, flags);
+                processNumber(out, (u32)(uintptr_t)va_arg(args, void *), false, true, fieldWidth, precision, flags);
                 continue;
 
             //Integer number formats - set up the flags and "break"
@@ -277,21 +319,27 @@ int vsprintf(char *buf, const char *fmt, va_list args)
                 break;
 
             default:
-                if(*fmt != '%') *str++ = '%';
-                if(*fmt) *str++ = *fmt;
+                if(*fmt != '%') put(out, '%');
+                if(*fmt) put(out, *fmt);
                 else fmt--;
                 continue;
         }
 
-        s64 num;
+        u64 num;
+        bool isNegative = false;
 
         if(flags & SIGN)
         {
-            if(integerType == 1) num = va_arg(args, s64);
-            else num = va_arg(args, s32);
+            s64 value;
+
+            if(integerType == 1) value = va_arg(args, s64);
+            else value = va_arg(args, s32);
 
-            if(integerType == 2) num = (s16)num;
-            else if(integerType == 3) num = (s8)num;
+            if(integerType == 2) value = (s16)value;
+            else if(integerType == 3) value = (s8)value;
+
+            isNegative = value < 0;
+            num = isNegative ? -(u64)value : (u64)value;
         }
         else
         {
@@ -302,11 +350,37 @@ int vsprintf(char *buf, const char *fmt, va_list args)
             else if(integerType == 3) num = (u8)num;
         }
 
-        str = processNumber(str, num, isHex, fieldWidth, precision, flags);
+        processNumber(out, num, isNegative, isHex, fieldWidth, precision, flags);
     }
+}
+
+int vsnprintf(char *buf, size_t size, const char *fmt, va_list args)
+{
+    Output out = { buf, size != 0 ? (u32)size - 1 : 0, 0 };
+
+    format(&out, fmt, args);
+    if(size != 0) buf[out.count < out.capacity ? out.count : out.capacity] = 0;
 
-    *str = 0;
-    return (int)(str - buf);
+    return (int)out.count;
+}
+
+int vsprintf(char *buf, const char *fmt, va_list args)
+{
+    Output out = { buf, 0xFFFFFFFF, 0 };
+
+    format(&out, fmt, args);
+    buf[out.count] = 0;
+
+    return (int)out.count;
+}
+
+int snprintf(char *buf, size_t size, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int res = vsnprintf(buf, size, fmt, args);
+    va_end(args);
+    return res;
 }
 
 int sprintf(char *buf, const char *fmt, ...)
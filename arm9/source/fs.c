@@ -7,12 +7,15 @@
 #include "draw.h"
 #include "utils.h"
 #include "fatfs/ff.h"
+#include "fatfs/diskio.h"
 #include "buttons.h"
 #include "firm.h"
 // #include "crypto.h"
 // #include "strings.h"
 // #include "alignedseqmemcpy.h"
 #include "i2c.h"
+#include "trace.h"
+#include "fatfs/sdmmc/sdmmc.h"
 
 
 static FATFS sdFs;
@@ -41,9 +44,101 @@ static bool switchToMainDir()
 
 bool mountSdCardPartition()
 {
-    if(f_mount(&sdFs, "sdmc:", 1) == FR_OK)
-        return f_chdrive("sdmc:") == FR_OK && switchToMainDir();
-    return false;
+    if(f_mount(&sdFs, "sdmc:", 1) != FR_OK) return false;
+
+    bool ret = f_chdrive("sdmc:") == FR_OK && switchToMainDir();
+    traceStage(STAGE_MOUNT);
+
+    return ret;
+}
+
+//Fills linkMap with the (length, start cluster) runs of the first size bytes of an open file
+static bool mapFile(FIL *file, DWORD *linkMap, u32 size)
+{
+#if FF_FS_EXFAT
+    //exFAT NoFatChain: the file is one contiguous run and the FAT holds nothing for it
+    if(file->obj.stat == 2)
+    {
+        u32 clusterSize = (u32)file->obj.fs->csize * FF_MAX_SS;
+
+        linkMap[1] = (size + clusterSize - 1) / clusterSize;
+        linkMap[2] = file->obj.sclust;
+        linkMap[3] = 0;
+        return true;
+    }
+#else
+    (void)size;
+#endif
+
+    linkMap[0] = LINKMAP_ENTRIES;
+    file->cltbl = linkMap;
+    FRESULT res = f_lseek(file, CREATE_LINKMAP);
+    file->cltbl = NULL;
+
+    return res == FR_OK;
+}
+
+static inline LBA_t fragmentSector(const FATFS *fs, const DWORD *fragment)
+{
+    return fs->database + (LBA_t)fs->csize * (fragment[1] - 2);
+}
+
+//Reads size bytes at offset of an open file mapped by mapFile(), with one disk_read per contiguous fragment
+//where f_read would issue one per cluster
+static bool readMapped(FIL *file, const DWORD *linkMap, u8 *dest, u64 offset, u32 size)
+{
+    FATFS *fs = file->obj.fs;
+    u32 clusterSize = (u32)fs->csize * FF_MAX_SS;
+    u8 partial[FF_MAX_SS] __attribute__((aligned(4)));
+
+    for(const DWORD *fragment = linkMap + 1; size != 0 && fragment[0] != 0; fragment += 2)
+    {
+        u64 fragmentSize = (u64)fragment[0] * clusterSize;
+        if(offset >= fragmentSize)
+        {
+            offset -= fragmentSize;
+            continue;
+        }
+
+        LBA_t sector = fragmentSector(fs, fragment) + (LBA_t)(offset / FF_MAX_SS);
+        u32 skip = (u32)(offset % FF_MAX_SS),
+            length = fragmentSize - offset < size ? (u32)(fragmentSize - offset) : size,
+            done = 0;
+
+        //Partial sectors at either end go through a bounce buffer, dest may not have room for all of them
+        if(skip != 0 || length < FF_MAX_SS)
+        {
+            done = FF_MAX_SS - skip < length ? FF_MAX_SS - skip : length;
+            if(disk_read(fs->pdrv, partial, sector++, 1) != RES_OK) return false;
+            memcpy(dest, partial + skip, done);
+        }
+
+        u32 sectors = (length - done) / FF_MAX_SS;
+        if(sectors != 0 && disk_read(fs->pdrv, dest + done, sector, sectors) != RES_OK) return false;
+        done += sectors * FF_MAX_SS;
+        sector += sectors;
+
+        if(done != length)
+        {
+            if(disk_read(fs->pdrv, partial, sector, 1) != RES_OK) return false;
+            memcpy(dest + done, partial, length - done);
+        }
+
+        dest += length;
+        size -= length;
+        offset = 0;
+    }
+
+    return size == 0;
+}
+
+//Reads the first size bytes of an open file along its fragments. Returns false if the file can't be
+//mapped; the caller then uses f_read.
+static bool fileReadFragments(FIL *file, u8 *dest, u32 size)
+{
+    DWORD linkMap[LINKMAP_ENTRIES];
+
+    return mapFile(file, linkMap, size) && readMapped(file, linkMap, dest, 0, size);
 }
 
 u32 fileRead(void *dest, const char *path, u32 maxSize)
@@ -57,12 +152,218 @@ u32 fileRead(void *dest, const char *path, u32 maxSize)
     u32 size = f_size(&file);
     if(dest == NULL) ret = size;
     else if(size <= maxSize)
-        result = f_read(&file, dest, size, (unsigned int *)&ret);
+    {
+        u64 startTicks = timerTicks();
+        if(fileReadFragments(&file, dest, size)) ret = size;
+        else result = f_read(&file, dest, size, (unsigned int *)&ret);
+        bootTrace.lastReadTicks = timerTicks() - startTicks;
+        bootTrace.lastReadBytes = ret;
+    }
     result |= f_close(&file);
 
     return result == FR_OK ? ret : 0;
 }
 
+//Requests the next chunk into stream->buffers[stream->next]. Chunks never span two fragments, and the
+//last one is read up to the end of its sector, which the buffer (a multiple of the sector size) has room for.
+static void fileStreamStart(FileStream *stream)
+{
+    u32 length = stream->remaining < stream->chunkSize ? stream->remaining : stream->chunkSize;
+    u8 *dest = stream->buffers[stream->next];
+
+    stream->pending = 0;
+    if(length == 0) return;
+
+    if(stream->fragment == NULL)
+    {
+        UINT read;
+        if(f_read(&stream->file, dest, length, &read) != FR_OK || read != length) stream->error = true;
+    }
+    else
+    {
+        FATFS *fs = stream->file.obj.fs;
+        u64 left = (u64)stream->fragment[0] * fs->csize * FF_MAX_SS - stream->fragmentOffset;
+
+        if(stream->fragment[0] == 0) stream->error = true;
+        else
+        {
+            if(left < length) length = (u32)left;
+
+            LBA_t sector = fragmentSector(fs, stream->fragment) + (LBA_t)(stream->fragmentOffset / FF_MAX_SS);
+            if(disk_read_start(fs->pdrv, dest, sector, (length + FF_MAX_SS - 1) / FF_MAX_SS) != RES_OK)
+                stream->error = true;
+
+            stream->fragmentOffset += length;
+            if(stream->fragmentOffset == (u64)stream->fragment[0] * fs->csize * FF_MAX_SS)
+            {
+                stream->fragment += 2;
+                stream->fragmentOffset = 0;
+            }
+        }
+    }
+
+    if(stream->error) return;
+
+    stream->remaining -= length;
+    stream->pending = length;
+}
+
+bool fileStreamOpen(FileStream *stream, const char *path, u8 *buf0, u8 *buf1, u32 chunkSize)
+{
+    if(chunkSize == 0 || chunkSize % FF_MAX_SS != 0 || chunkSize / FF_MAX_SS > SDMMC_MAX_BLOCKS) return false;
+    if(f_open(&stream->file, path, FA_READ) != FR_OK) return false;
+
+    stream->remaining = f_size(&stream->file);
+    stream->fragment = mapFile(&stream->file, stream->linkMap, stream->remaining) ? stream->linkMap + 1 : NULL;
+    stream->fragmentOffset = 0;
+    stream->buffers[0] = buf0;
+    stream->buffers[1] = buf1;
+    stream->chunkSize = chunkSize;
+    stream->next = 0;
+    stream->error = false;
+
+    fileStreamStart(stream);
+
+    return true;
+}
+
+//Returns the next chunk of the file and its length, or NULL at the end of the file or on error.
+//The chunk stays valid until the following call, which starts reading into the other buffer.
+const u8 *fileStreamNext(FileStream *stream, u32 *size)
+{
+    *size = 0;
+    if(stream->pending == 0 || stream->error) return NULL;
+
+    if(stream->fragment != NULL && disk_read_wait(stream->file.obj.fs->pdrv) != RES_OK)
+    {
+        stream->error = true;
+        return NULL;
+    }
+
+    const u8 *chunk = stream->buffers[stream->next];
+    *size = stream->pending;
+
+    stream->next ^= 1;
+    fileStreamStart(stream);
+
+    return chunk;
+}
+
+//Returns false if any chunk failed to read
+bool fileStreamClose(FileStream *stream)
+{
+    //Don't leave a transfer running into a buffer the caller is about to reuse
+    if(stream->pending != 0 && !stream->error && stream->fragment != NULL &&
+       disk_read_wait(stream->file.obj.fs->pdrv) != RES_OK)
+        stream->error = true;
+
+    stream->pending = 0;
+
+    return f_close(&stream->file) == FR_OK && !stream->error;
+}
+
+//Reads parts of a file to unrelated places, e.g. FIRM sections straight to their load addresses.
+//Returns false if any part is outside the file or can't be read.
+bool fileReadExtents(const char *path, const FileExtent *extents, u32 count)
+{
+    FIL file;
+    DWORD linkMap[LINKMAP_ENTRIES];
+    bool ret = true;
+
+    if(f_open(&file, path, FA_READ) != FR_OK) return false;
+
+    u32 size = f_size(&file), total = 0;
+    bool isMapped = mapFile(&file, linkMap, size);
+    u64 startTicks = timerTicks();
+
+    for(u32 i = 0; i < count && ret; i++)
+    {
+        const FileExtent *extent = &extents[i];
+        UINT read;
+
+        if(extent->offset > size || extent->size > size - extent->offset) ret = false;
+        else if(!isMapped || !readMapped(&file, linkMap, extent->dest, extent->offset, extent->size))
+            ret = f_lseek(&file, extent->offset) == FR_OK && f_read(&file, extent->dest, extent->size, &read) == FR_OK &&
+                  read == extent->size;
+
+        total += extent->size;
+    }
+
+    bootTrace.lastReadTicks = timerTicks() - startTicks;
+    bootTrace.lastReadBytes = ret ? total : 0;
+
+    return f_close(&file) == FR_OK && ret;
+}
+
+//Reads the first size bytes of a file, e.g. a header to check before reading the rest.
+//Returns the size of the whole file, or 0 if it is shorter than size or can't be read.
+u32 fileReadHead(void *dest, const char *path, u32 size)
+{
+    FIL file;
+    UINT read;
+    u32 ret = 0;
+
+    if(f_open(&file, path, FA_READ) != FR_OK) return ret;
+
+    if(f_read(&file, dest, size, &read) == FR_OK && read == size) ret = f_size(&file);
+    if(f_close(&file) != FR_OK) ret = 0;
+
+    return ret;
+}
+
+static u32 ticksToMs(u64 ticks)
+{
+    return (u32)timerTicksToMs(ticks);
+}
+
+// Nothing has been read from a payload yet when the menu shows, so the overlay times a read of the start
+// of one. Returns the speed in KiB/s, 0 if the file can't be read.
+static u32 probeReadSpeed(const char *name, u32 *probedBytes)
+{
+    static u8 buf[0x2000] __attribute__((aligned(32)));
+    char path[10 + 49];
+    FIL file;
+    UINT read;
+    u32 total = 0;
+
+    *probedBytes = 0;
+    snprintf(path, sizeof(path), "luma/%s.firm", name);
+    if(f_open(&file, path, FA_READ) != FR_OK) return 0;
+
+    u64 startTicks = timerTicks();
+    while(total < PERF_PROBE_SIZE && f_read(&file, buf, sizeof(buf), &read) == FR_OK && read != 0) total += read;
+    u64 ticks = timerTicks() - startTicks;
+
+    f_close(&file);
+    *probedBytes = total;
+
+    return ticks != 0 ? (u32)((u64)total * TICKS_PER_SEC / ticks / 1024) : 0;
+}
+
+// Bottom screen summary of where the boot time went, shown once PERF_OVERLAY_BUTTONS is held in the menu
+static void drawPerfOverlay(const char *payloadName)
+{
+    static bool isDrawn = false;
+
+    if(isDrawn) return;
+
+    u32 posY = 10, probedBytes,
+        kbPerSec = probeReadSpeed(payloadName, &probedBytes);
+
+    drawString(false, 10, posY, COLOR_TITLE, "Performance");
+    posY = drawFormattedString(false, 10, posY + 2 * SPACING_Y, COLOR_WHITE, "SD init: %lu ms", ticksToMs(traceStageTicks(STAGE_SD_INIT)));
+    posY = drawFormattedString(false, 10, posY + SPACING_Y, COLOR_WHITE, "SD bus:  %lu kHz, %lu-bit", sdmmc_sdcard_clock() / 1000, sdmmc_sdcard_buswidth());
+    posY = drawFormattedString(false, 10, posY + SPACING_Y, COLOR_WHITE, "Mount:   %lu ms", ticksToMs(traceStageTicks(STAGE_MOUNT)));
+    posY = drawFormattedString(false, 10, posY + SPACING_Y, COLOR_WHITE, "Scan:    %lu ms", ticksToMs(traceStageTicks(STAGE_SCAN)));
+
+    if(kbPerSec != 0)
+        drawFormattedString(false, 10, posY + SPACING_Y, COLOR_WHITE, "Read:    %lu KiB/s over %lu KiB",
+                            kbPerSec, probedBytes / 1024);
+    else drawString(false, 10, posY + SPACING_Y, COLOR_WHITE, "Read:    none");
+
+    isDrawn = true;
+}
+
 bool payloadMenu(char *path)
 {
     mcuSetInfoLedPattern(0, 255, 255, 0, false);
@@ -93,12 +394,17 @@ bool payloadMenu(char *path)
 
     if(f_closedir(&dir) != FR_OK || !payloadNum) return false;
 
+    traceStage(STAGE_SCAN);
+
     u32 pressed = 0,
         selectedPayload = 0;
 
-    if(payloadNum != 1)
+    bool wantsPerfOverlay = (HID_PAD & PERF_OVERLAY_BUTTONS) != 0;
+
+    if(payloadNum != 1 || wantsPerfOverlay)
     {
         initScreens();
+        if(wantsPerfOverlay) drawPerfOverlay(payloadList[selectedPayload]);
         
         drawString(true, 10, 10, COLOR_TITLE, "Luma3DS chainloader");
         drawString(true, 10, 10 + SPACING_Y, COLOR_TITLE, "Press A to select, START to quit");
@@ -113,7 +419,9 @@ bool payloadMenu(char *path)
         {
             do
             {
-                pressed = waitInput(true) & MENU_BUTTONS;
+                pressed = waitInput(true);
+                if(pressed & PERF_OVERLAY_BUTTONS) drawPerfOverlay(payloadList[selectedPayload]);
+                pressed &= MENU_BUTTONS;
             }
             while(!pressed);
 
@@ -147,6 +455,7 @@ bool payloadMenu(char *path)
     if(pressed != BUTTON_START)
     {
         sprintf(path, "luma/%s.firm", payloadList[selectedPayload]);
+        traceStage(STAGE_MENU);
 
         return true;
     }
@@ -155,5 +464,6 @@ bool payloadMenu(char *path)
     wait(2000ULL);
 
     mcuSetInfoLedPattern(255, 0, 0, 0, false);
+    I2C_flush(); //nothing drives the queue once the loader gives up, send the red pattern now
     return false;
 }
\ No newline at end of file
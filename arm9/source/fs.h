@@ -1,8 +1,37 @@
 #pragma once
 
 #include "types.h"
+#include "fatfs/ff.h"
+
+#define LINKMAP_ENTRIES 64 //room for 31 fragments, more than any payload has in practice
+#define PERF_PROBE_SIZE (256 * 1024) //bytes of a payload the performance overlay reads to time the SD card
+
+//A file read in chunks, the next chunk being fetched into one buffer while the caller consumes the other.
+//No other file system access may happen between fileStreamOpen() and fileStreamClose().
+typedef struct FileStream {
+    FIL file;
+    DWORD linkMap[LINKMAP_ENTRIES];
+    DWORD *fragment;        //NULL if the file couldn't be mapped (chunks then come from f_read)
+    u64 fragmentOffset;     //bytes of the current fragment already requested
+    u32 remaining;          //bytes of the file not yet requested
+    u8 *buffers[2];
+    u32 chunkSize;          //multiple of the sector size
+    u32 pending;            //bytes of the chunk in flight, 0 once the file has been read
+    u32 next;               //buffer the chunk in flight goes to
+    bool error;
+} FileStream;
+
+typedef struct FileExtent {
+    void *dest;
+    u32 offset, size;
+} FileExtent;
 
 bool mountSdCardPartition(void);
 
 u32 fileRead(void *dest, const char *path, u32 maxSize);
+u32 fileReadHead(void *dest, const char *path, u32 size);
+bool fileReadExtents(const char *path, const FileExtent *extents, u32 count);
+bool fileStreamOpen(FileStream *stream, const char *path, u8 *buf0, u8 *buf1, u32 chunkSize);
+const u8 *fileStreamNext(FileStream *stream, u32 *size);
+bool fileStreamClose(FileStream *stream);
 bool payloadMenu(char *path);
\ No newline at end of file
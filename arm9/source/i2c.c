@@ -20,6 +20,10 @@
 #include "types.h"
 #include "i2c.h"
 #include "utils.h"
+#include "timer.h"
+#ifdef I2C_USE_IRQ
+#include "irq.h"
+#endif
 
 #define I2C1_REGS_BASE  (0x10161000)
 
@@ -90,6 +94,173 @@ static I2cRegs* i2cGetBusRegsBase(u8 busId)
     return base;
 }
 
+enum
+{
+    I2C_STAGE_START,       // nothing sent yet
+    I2C_STAGE_DEVICE,      // device address sent
+    I2C_STAGE_REGISTER,    // register address sent
+    I2C_STAGE_READ_DEVICE, // device address sent again, in read mode
+    I2C_STAGE_DATA,        // a data byte sent or received
+    I2C_STAGE_BACKOFF      // waiting to start over after a NACK
+};
+
+#define I2C_START_ATTEMPTS      8
+#define I2C_RETRY_BACKOFF_US    50    // doubled after every failed attempt
+#define I2C_STEP_US             20    // timer period while transfers are queued (I2C_USE_IRQ)
+
+static I2cTransfer *queueHead, *queueTail;
+
+#ifdef I2C_USE_IRQ
+static inline u32 lockQueue(void)
+{
+    return disableIrqs();
+}
+
+static inline void unlockQueue(u32 cpsr)
+{
+    restoreIrqs(cpsr);
+}
+
+static void startStepTimer(void)
+{
+    if(REG_TIMER_CNT(TIMER_FREE) & TIMER_ENABLE) return;
+
+    REG_TIMER_VAL(TIMER_FREE) = (u16)(0x10000 - timerUsToTicks(I2C_STEP_US)); // reload value
+    REG_TIMER_CNT(TIMER_FREE) = TIMER_ENABLE | TIMER_IRQ_ENABLE | TIMER_PRESCALER_1;
+}
+
+// Whoever empties the queue stops the timer, the IRQ handler or a poll with interrupts masked,
+// so it can't keep firing into the payload after chainload
+static void stopStepTimerIfIdle(void)
+{
+    if(queueHead == NULL) REG_TIMER_CNT(TIMER_FREE) = 0;
+}
+#else
+static inline u32 lockQueue(void)
+{
+    return 0;
+}
+
+static inline void unlockQueue(u32 cpsr)
+{
+    (void)cpsr;
+}
+
+static inline void startStepTimer(void)
+{
+}
+
+static inline void stopStepTimerIfIdle(void)
+{
+}
+#endif
+
+static void i2cFinish(I2cTransfer *transfer, I2cStatus status)
+{
+    queueHead = transfer->next;
+    if(queueHead == NULL) queueTail = NULL;
+
+    transfer->status = status; // last, the owner may reuse it from here on
+}
+
+static void i2cSendByte(I2cTransfer *transfer, I2cRegs *const regs)
+{
+    regs->REG_I2C_DATA = transfer->in[transfer->pos++];
+    regs->REG_I2C_CNT = I2C_ENABLE | I2C_IRQ_ENABLE | I2C_DIRE_WRITE | (transfer->pos == transfer->size ? I2C_STOP : 0);
+}
+
+static void i2cReceiveByte(const I2cTransfer *transfer, I2cRegs *const regs)
+{
+    regs->REG_I2C_CNT = I2C_ENABLE | I2C_IRQ_ENABLE | I2C_DIRE_READ | (transfer->pos + 1 == transfer->size ? I2C_STOP : I2C_ACK);
+}
+
+// Moves the transfer at the head of the queue on by one bus operation, if the bus is done with the last one
+static void i2cStep(void)
+{
+    I2cTransfer *const transfer = queueHead;
+    if(transfer == NULL) return;
+
+    const u8 devAddr = i2cDevTable[transfer->devId].devAddr;
+    I2cRegs *const regs = i2cGetBusRegsBase(i2cDevTable[transfer->devId].busId);
+    const bool isRead = transfer->out != NULL;
+
+    if(regs->REG_I2C_CNT & I2C_ENABLE) return;
+
+    // Everything sent so far must have been acknowledged
+    const bool hasSent = transfer->stage != I2C_STAGE_START && transfer->stage != I2C_STAGE_BACKOFF &&
+                         !(transfer->stage == I2C_STAGE_DATA && isRead);
+    if(hasSent && !I2C_GET_ACK(regs->REG_I2C_CNT)) // If ack flag is 0 it failed.
+    {
+        regs->REG_I2C_CNT = I2C_ENABLE | I2C_IRQ_ENABLE | I2C_ERROR | I2C_STOP;
+
+        // Only the start of a transfer is retried, a data byte the device rejected is an error
+        if(transfer->stage == I2C_STAGE_DATA || ++transfer->attempts == I2C_START_ATTEMPTS)
+            i2cFinish(transfer, I2C_FAILED);
+        else
+        {
+            transfer->retryDeadline = timerTicks() + timerUsToTicks(I2C_RETRY_BACKOFF_US << (transfer->attempts - 1));
+            transfer->stage = I2C_STAGE_BACKOFF;
+        }
+        return;
+    }
+
+    switch(transfer->stage)
+    {
+        case I2C_STAGE_BACKOFF:
+            if(!timerExpired(transfer->retryDeadline)) break;
+            // Fall through
+        case I2C_STAGE_START:
+            // Select device and start.
+            regs->REG_I2C_DATA = devAddr;
+            regs->REG_I2C_CNT = I2C_ENABLE | I2C_IRQ_ENABLE | I2C_START;
+            transfer->stage = I2C_STAGE_DEVICE;
+            break;
+
+        case I2C_STAGE_DEVICE:
+            // Select register and change direction to write.
+            regs->REG_I2C_DATA = transfer->regAddr;
+            regs->REG_I2C_CNT = I2C_ENABLE | I2C_IRQ_ENABLE | I2C_DIRE_WRITE;
+            transfer->stage = I2C_STAGE_REGISTER;
+            break;
+
+        case I2C_STAGE_REGISTER:
+            if(isRead)
+            {
+                // Select device in read mode for read transfer.
+                regs->REG_I2C_DATA = devAddr | 1u; // Set bit 0 for read.
+                regs->REG_I2C_CNT = I2C_ENABLE | I2C_IRQ_ENABLE | I2C_START;
+                transfer->stage = I2C_STAGE_READ_DEVICE;
+            }
+            else
+            {
+                transfer->stage = I2C_STAGE_DATA;
+                i2cSendByte(transfer, regs);
+            }
+            break;
+
+        case I2C_STAGE_READ_DEVICE:
+            transfer->stage = I2C_STAGE_DATA;
+            i2cReceiveByte(transfer, regs);
+            break;
+
+        case I2C_STAGE_DATA:
+            if(isRead) transfer->out[transfer->pos++] = regs->REG_I2C_DATA;
+
+            if(transfer->pos == transfer->size) i2cFinish(transfer, I2C_DONE);
+            else if(isRead) i2cReceiveByte(transfer, regs);
+            else i2cSendByte(transfer, regs);
+            break;
+    }
+}
+
+#ifdef I2C_USE_IRQ
+static void i2cTimerIrqHandler(void)
+{
+    i2cStep();
+    stopStepTimerIfIdle();
+}
+#endif
+
 void I2C_init(void)
 {
     I2cRegs *regs = i2cGetBusRegsBase(0); // Bus 1
@@ -106,108 +277,103 @@ void I2C_init(void)
     i2cWaitBusy(regs);
     regs->REG_I2C_CNTEX = 2;  // ?
     regs->REG_I2C_SCL = 1280; // ?
+
+#ifdef I2C_USE_IRQ
+    irqInit();
+    irqRegister(IRQ_TIMER(TIMER_FREE), i2cTimerIrqHandler);
+#endif
 }
 
-static bool i2cStartTransfer(I2cDevice devId, u8 regAddr, bool read, I2cRegs *const regs)
+static void i2cSubmit(I2cTransfer *transfer, I2cDevice devId, u8 regAddr, const u8 *in, u8 *out, u32 size)
 {
-    const u8 devAddr = i2cDevTable[devId].devAddr;
-
-
-    u32 i = 0;
-    for(; i < 8; i++)
+    transfer->next = NULL;
+    transfer->in = in;
+    transfer->out = out;
+    transfer->size = size;
+    transfer->pos = 0;
+    transfer->devId = devId;
+    transfer->regAddr = regAddr;
+    transfer->stage = I2C_STAGE_START;
+    transfer->attempts = 0;
+
+    if(size == 0)
     {
-        i2cWaitBusy(regs);
+        transfer->status = I2C_FAILED;
+        return;
+    }
+    transfer->status = I2C_PENDING;
 
-        // Select device and start.
-        regs->REG_I2C_DATA = devAddr;
-        regs->REG_I2C_CNT = I2C_ENABLE | I2C_IRQ_ENABLE | I2C_START;
-        i2cWaitBusy(regs);
-        if(!I2C_GET_ACK(regs->REG_I2C_CNT)) // If ack flag is 0 it failed.
-        {
-            regs->REG_I2C_CNT = I2C_ENABLE | I2C_IRQ_ENABLE | I2C_ERROR | I2C_STOP;
-            continue;
-        }
+    u32 cpsr = lockQueue();
 
-        // Select register and change direction to write.
-        regs->REG_I2C_DATA = regAddr;
-        regs->REG_I2C_CNT = I2C_ENABLE | I2C_IRQ_ENABLE | I2C_DIRE_WRITE;
-        i2cWaitBusy(regs);
-        if(!I2C_GET_ACK(regs->REG_I2C_CNT)) // If ack flag is 0 it failed.
-        {
-            regs->REG_I2C_CNT = I2C_ENABLE | I2C_IRQ_ENABLE | I2C_ERROR | I2C_STOP;
-            continue;
-        }
+    if(queueTail != NULL) queueTail->next = transfer;
+    else queueHead = transfer;
+    queueTail = transfer;
+    startStepTimer();
 
-        // Select device in read mode for read transfer.
-        if(read)
-        {
-            regs->REG_I2C_DATA = devAddr | 1u; // Set bit 0 for read.
-            regs->REG_I2C_CNT = I2C_ENABLE | I2C_IRQ_ENABLE | I2C_START;
-            i2cWaitBusy(regs);
-            if(!I2C_GET_ACK(regs->REG_I2C_CNT)) // If ack flag is 0 it failed.
-            {
-                regs->REG_I2C_CNT = I2C_ENABLE | I2C_IRQ_ENABLE | I2C_ERROR | I2C_STOP;
-                continue;
-            }
-        }
+    unlockQueue(cpsr);
+}
 
-        break;
-    }
+void I2C_readRegBufAsync(I2cTransfer *transfer, I2cDevice devId, u8 regAddr, u8 *out, u32 size)
+{
+    i2cSubmit(transfer, devId, regAddr, NULL, out, size);
+}
 
-    if(i < 8) return true;
-    else return false;
+void I2C_writeRegBufAsync(I2cTransfer *transfer, I2cDevice devId, u8 regAddr, const u8 *in, u32 size)
+{
+    i2cSubmit(transfer, devId, regAddr, in, NULL, size);
 }
 
-bool I2C_readRegBuf(I2cDevice devId, u8 regAddr, u8 *out, u32 size)
+void I2C_poll(void)
 {
-    const u8 busId = i2cDevTable[devId].busId;
-    I2cRegs *const regs = i2cGetBusRegsBase(busId);
+    u32 cpsr = lockQueue();
+    i2cStep();
+    stopStepTimerIfIdle();
+    unlockQueue(cpsr);
+}
 
+// Steps the queue itself, so this completes in the polling build and with interrupts masked alike
+bool I2C_wait(I2cTransfer *transfer)
+{
+    while(transfer->status == I2C_PENDING) I2C_poll();
 
-    if(!i2cStartTransfer(devId, regAddr, true, regs)) return false;
+    return transfer->status == I2C_DONE;
+}
 
-    while(--size)
-    {
-        regs->REG_I2C_CNT = I2C_ENABLE | I2C_IRQ_ENABLE | I2C_DIRE_READ | I2C_ACK;
-        i2cWaitBusy(regs);
-        *out++ = regs->REG_I2C_DATA;
-    }
+void I2C_flush(void)
+{
+    while(queueHead != NULL) I2C_poll();
+}
 
-    regs->REG_I2C_CNT = I2C_ENABLE | I2C_IRQ_ENABLE | I2C_DIRE_READ | I2C_STOP;
-    i2cWaitBusy(regs);
-    *out = regs->REG_I2C_DATA; // Last byte
+bool I2C_readRegBuf(I2cDevice devId, u8 regAddr, u8 *out, u32 size)
+{
+    I2cTransfer transfer;
 
-    return true;
+    I2C_readRegBufAsync(&transfer, devId, regAddr, out, size);
+    return I2C_wait(&transfer);
 }
 
 bool I2C_writeRegBuf(I2cDevice devId, u8 regAddr, const u8 *in, u32 size)
 {
-    const u8 busId = i2cDevTable[devId].busId;
-    I2cRegs *const regs = i2cGetBusRegsBase(busId);
+    I2cTransfer transfer;
 
+    I2C_writeRegBufAsync(&transfer, devId, regAddr, in, size);
+    return I2C_wait(&transfer);
+}
 
-    if(!i2cStartTransfer(devId, regAddr, false, regs)) return false;
+bool I2C_readRegList(I2cDevice devId, const u8 *regAddrs, u8 *out, u32 count)
+{
+    u8 window[I2C_MAX_WINDOW];
+    u8 first = 0xFF, last = 0;
 
-    while(--size)
+    for(u32 i = 0; i < count; i++)
     {
-        regs->REG_I2C_DATA = *in++;
-        regs->REG_I2C_CNT = I2C_ENABLE | I2C_IRQ_ENABLE | I2C_DIRE_WRITE;
-        i2cWaitBusy(regs);
-        if(!I2C_GET_ACK(regs->REG_I2C_CNT)) // If ack flag is 0 it failed.
-        {
-            regs->REG_I2C_CNT = I2C_ENABLE | I2C_IRQ_ENABLE | I2C_ERROR | I2C_STOP;
-            return false;
-        }
+        if(regAddrs[i] < first) first = regAddrs[i];
+        if(regAddrs[i] > last) last = regAddrs[i];
     }
+    if(count == 0 || last - first >= I2C_MAX_WINDOW) return false;
 
-    regs->REG_I2C_DATA = *in;
-    regs->REG_I2C_CNT = I2C_ENABLE | I2C_IRQ_ENABLE | I2C_DIRE_WRITE | I2C_STOP;
-    i2cWaitBusy(regs);
-    if(!I2C_GET_ACK(regs->REG_I2C_CNT)) // If ack flag is 0 it failed.
-    {
-        regs->REG_I2C_CNT = I2C_ENABLE | I2C_IRQ_ENABLE | I2C_ERROR | I2C_STOP;
-        return false;
-    }
+    if(!I2C_readRegBuf(devId, first, window, last - first + 1)) return false;
+    for(u32 i = 0; i < count; i++) out[i] = window[regAddrs[i] - first];
 
     return true;
 }
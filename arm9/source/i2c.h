@@ -33,6 +33,8 @@
 
 #define I2C_GET_ACK(reg)  ((bool)((reg)>>4 & 1u))
 
+#define I2C_MAX_WINDOW    32 // registers read by I2C_readRegList in one go
+
 
 typedef enum
 {
@@ -49,6 +51,32 @@ typedef enum
     I2C_DEV_N3DS_HID  = 17
 } I2cDevice;
 
+typedef enum
+{
+    I2C_PENDING = 0,
+    I2C_DONE,
+    I2C_FAILED
+} I2cStatus;
+
+/**
+ * @brief      A queued transfer. Owned by the caller, who must keep it alive until it completes.
+ *             The fields are private to the driver.
+ */
+typedef struct I2cTransfer
+{
+    struct I2cTransfer *next;
+    const u8 *in;
+    u8 *out;
+    u32 size;
+    u32 pos;
+    u64 retryDeadline;
+    I2cDevice devId;
+    u8 regAddr;
+    u8 stage;
+    u8 attempts;
+    volatile I2cStatus status;
+} I2cTransfer;
+
 
 
 /**
@@ -80,6 +108,20 @@ bool I2C_readRegBuf(I2cDevice devId, u8 regAddr, u8 *out, u32 size);
  */
 bool I2C_writeRegBuf(I2cDevice devId, u8 regAddr, const u8 *in, u32 size);
 
+/**
+ * @brief      Reads several registers in one transaction, for devices that advance the register
+ *             address as they are read (the MCU does). The window from the lowest to the highest
+ *             register is read and the requested ones picked out of it.
+ *
+ * @param[in]  devId     The device ID. Use the enum above.
+ * @param[in]  regAddrs  The register addresses, in any order.
+ * @param      out       The output buffer, one byte per register address.
+ * @param[in]  count     The number of registers.
+ *
+ * @return     Returns true on success and false on failure, including a window over I2C_MAX_WINDOW.
+ */
+bool I2C_readRegList(I2cDevice devId, const u8 *regAddrs, u8 *out, u32 count);
+
 /**
  * @brief      Reads a byte from a I2C register.
  *
@@ -100,3 +142,46 @@ u8 I2C_readReg(I2cDevice devId, u8 regAddr);
  * @return     Returns true on success and false on failure.
  */
 bool I2C_writeReg(I2cDevice devId, u8 regAddr, u8 data);
+
+/**
+ * @brief      Queues a read from a I2C register to a buffer and returns right away. Transfers run
+ *             one at a time in submission order, advanced by I2C_poll() and I2C_wait(), and with
+ *             I2C_USE_IRQ from the timer interrupt as well.
+ *
+ * @param      transfer  The transfer to queue.
+ * @param[in]  devId     The device ID. Use the enum above.
+ * @param[in]  regAddr   The register address.
+ * @param      out       The output buffer pointer, written as the transfer goes.
+ * @param[in]  size      The read size.
+ */
+void I2C_readRegBufAsync(I2cTransfer *transfer, I2cDevice devId, u8 regAddr, u8 *out, u32 size);
+
+/**
+ * @brief      Queues a write of a buffer to a I2C register and returns right away.
+ *
+ * @param      transfer  The transfer to queue.
+ * @param[in]  devId     The device ID. Use the enum above.
+ * @param[in]  regAddr   The register address.
+ * @param[in]  in        The input buffer pointer, which must stay valid until the transfer completes.
+ * @param[in]  size      The write size.
+ */
+void I2C_writeRegBufAsync(I2cTransfer *transfer, I2cDevice devId, u8 regAddr, const u8 *in, u32 size);
+
+/**
+ * @brief      Advances the queue by at most one bus operation, without waiting on the bus.
+ */
+void I2C_poll(void);
+
+/**
+ * @brief      Runs the queue until a transfer completes.
+ *
+ * @param      transfer  A queued transfer.
+ *
+ * @return     Returns true on success and false on failure.
+ */
+bool I2C_wait(I2cTransfer *transfer);
+
+/**
+ * @brief      Runs the queue until it is empty, e.g. before handing the hardware to a payload.
+ */
+void I2C_flush(void);
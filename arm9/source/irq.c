@@ -0,0 +1,97 @@
+/*
+*   Minimal ARM9 interrupt dispatcher. The boot ROM's IRQ vector jumps to
+*   0x08000000, where irqInit() places a branch to irqEntry (irq.s).
+*/
+
+#include "irq.h"
+
+#define IRQ_VECTOR      ((vu32 *)0x08000000)
+#define IRQ_STACK_SIZE  0x400
+
+static IrqHandler handlers[32];
+static bool isInitialized;
+static u32 irqStack[IRQ_STACK_SIZE / 4] __attribute__((aligned(8)));
+
+void irqEntry(void);
+void irqSetStack(u32 *top);
+
+static inline void waitForInterrupt(void)
+{
+    __asm__ volatile("mcr p15, 0, %0, c7, c0, 4" :: "r"(0) : "memory");
+}
+
+// Called from irqEntry with IRQs masked
+void irqDispatch(void)
+{
+    u32 pending = REG_IRQ_IF & REG_IRQ_IE;
+
+    // Acknowledge first, so a source that fires again while its handler runs is not lost
+    REG_IRQ_IF = pending;
+
+    while(pending != 0)
+    {
+        u32 irq = __builtin_ctz(pending);
+        pending &= pending - 1;
+        if(handlers[irq] != NULL) handlers[irq]();
+    }
+}
+
+void irqInit(void)
+{
+    if(isInitialized) return;
+
+    disableIrqs();
+    REG_IRQ_IE = 0;
+    REG_IRQ_IF = 0xFFFFFFFF;
+
+    irqSetStack(irqStack + IRQ_STACK_SIZE / 4);
+
+    // ldr pc, [pc, #-4]; .word irqEntry
+    IRQ_VECTOR[0] = 0xE51FF004;
+    IRQ_VECTOR[1] = (u32)irqEntry;
+
+    // The vector is written through the data cache and fetched by the instruction side
+    __asm__ volatile(
+        "mcr p15, 0, %0, c7, c10, 1\n\t" // clean D-cache line
+        "mcr p15, 0, %1, c7, c10, 4\n\t" // drain write buffer
+        "mcr p15, 0, %0, c7, c5, 1"      // invalidate I-cache line
+        :: "r"(IRQ_VECTOR), "r"(0) : "memory");
+
+    isInitialized = true;
+    restoreIrqs(disableIrqs() & ~0x80);
+}
+
+// Leaves interrupts the way the boot ROM hands them to a payload
+void irqDeinit(void)
+{
+    disableIrqs();
+    REG_IRQ_IE = 0;
+    REG_IRQ_IF = 0xFFFFFFFF;
+    isInitialized = false;
+}
+
+void irqRegister(u32 irq, IrqHandler handler)
+{
+    u32 cpsr = disableIrqs();
+
+    handlers[irq] = handler;
+    if(handler != NULL) REG_IRQ_IE |= 1u << irq;
+    else REG_IRQ_IE &= ~(1u << irq);
+
+    restoreIrqs(cpsr);
+}
+
+void irqWaitFor(volatile const bool *done)
+{
+    u32 cpsr = disableIrqs();
+
+    while(!*done)
+    {
+        // Wakes on a pending IRQ even though it is masked here; it is taken once unmasked
+        waitForInterrupt();
+        restoreIrqs(cpsr);
+        disableIrqs();
+    }
+
+    restoreIrqs(cpsr);
+}
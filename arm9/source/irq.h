@@ -0,0 +1,35 @@
+#pragma once
+
+#include "types.h"
+
+#define REG_IRQ_IE      (*(vu32 *)0x10001000)
+#define REG_IRQ_IF      (*(vu32 *)0x10001004)
+
+// ARM9 interrupt sources (bits of IE/IF)
+#define IRQ_TIMER(n)    (8 + (n))
+#define IRQ_SDIO_1      16
+
+typedef void (*IrqHandler)(void);
+
+// armv5te has no cps, the I bit is set through msr
+static inline u32 disableIrqs(void)
+{
+    u32 cpsr;
+    __asm__ volatile("mrs %0, cpsr" : "=r"(cpsr));
+    __asm__ volatile("msr cpsr_c, %0" :: "r"(cpsr | 0x80) : "memory");
+    return cpsr;
+}
+
+static inline void restoreIrqs(u32 cpsr)
+{
+    __asm__ volatile("msr cpsr_c, %0" :: "r"(cpsr) : "memory");
+}
+
+// Does nothing if already initialized, so every user can call it
+void irqInit(void);
+void irqDeinit(void);
+void irqRegister(u32 irq, IrqHandler handler);
+
+// Sleeps until *done is set by a handler. The flag is checked with interrupts masked
+// and the CPU woken by any pending IRQ, so a completion can't slip in before the sleep.
+void irqWaitFor(volatile const bool *done);
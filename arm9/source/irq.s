@@ -0,0 +1,26 @@
+@ IRQ entry for irq.c. Runs in IRQ mode on the stack set by irqSetStack.
+
+.section .text.irqEntry, "ax", %progbits
+.arm
+.align 2
+.global irqEntry
+.type   irqEntry, %function
+irqEntry:
+    sub lr, lr, #4
+    stmfd sp!, {r0-r3, r12, lr}
+    bl irqDispatch
+    ldmfd sp!, {r0-r3, r12, pc}^
+
+.section .text.irqSetStack, "ax", %progbits
+.arm
+.align 2
+.global irqSetStack
+.type   irqSetStack, %function
+irqSetStack:
+    mrs r1, cpsr
+    bic r2, r1, #0x1F
+    orr r2, r2, #0xD2           @ IRQ mode, IRQ/FIQ masked
+    msr cpsr_c, r2
+    mov sp, r0
+    msr cpsr_c, r1
+    bx lr
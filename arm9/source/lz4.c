@@ -0,0 +1,92 @@
+/*
+*   LZ4 block decoder. It is linked into ITCM with the chainloader, which
+*   decodes compressed FIRM sections straight to their load addresses.
+*/
+
+#include "lz4.h"
+
+#pragma GCC optimize (3)
+// The literal and match copy loops must stay loops instead of becoming memcpy calls into the main image
+#pragma GCC optimize ("no-tree-loop-distribute-patterns")
+
+#define LZ4_MIN_MATCH   4
+
+// Forward copy. A match may overlap its own output, so words are only used when
+// both sides are aligned and at least a word apart.
+static void copyForward(u8 *dst, const u8 *src, u32 len)
+{
+    if((((uintptr_t)dst | (uintptr_t)src) & 3) == 0 && (uintptr_t)(dst - src) >= 4)
+    {
+        u32 *dst32 = (u32 *)dst;
+        const u32 *src32 = (const u32 *)src;
+
+        for(; len >= 16; len -= 16)
+        {
+            dst32[0] = src32[0];
+            dst32[1] = src32[1];
+            dst32[2] = src32[2];
+            dst32[3] = src32[3];
+            dst32 += 4;
+            src32 += 4;
+        }
+        for(; len >= 4; len -= 4) *dst32++ = *src32++;
+
+        dst = (u8 *)dst32;
+        src = (const u8 *)src32;
+    }
+
+    while(len-- != 0) *dst++ = *src++;
+}
+
+// Lengths of 15 continue in the following bytes, each 255 meaning another byte follows
+static bool readLength(const u8 **src, const u8 *srcEnd, u32 *length)
+{
+    u32 b;
+
+    do
+    {
+        if(*src == srcEnd) return false;
+        b = *(*src)++;
+        *length += b;
+    }
+    while(b == 255);
+
+    return true;
+}
+
+u32 lz4Decompress(u8 *dst, u32 dstSize, const u8 *src, u32 srcSize)
+{
+    const u8 *srcEnd = src + srcSize;
+    u32 pos = 0;
+
+    while(src != srcEnd)
+    {
+        u32 token = *src++,
+            length = token >> 4;
+
+        if(length == 15 && !readLength(&src, srcEnd, &length)) return 0;
+        if((u32)(srcEnd - src) < length || dstSize - pos < length) return 0;
+
+        if(dst != NULL) copyForward(dst + pos, src, length);
+        src += length;
+        pos += length;
+
+        // The last sequence has literals only
+        if(src == srcEnd) break;
+
+        if(srcEnd - src < 2) return 0;
+        u32 offset = src[0] | (src[1] << 8);
+        src += 2;
+        if(offset == 0 || offset > pos) return 0;
+
+        length = token & 15;
+        if(length == 15 && !readLength(&src, srcEnd, &length)) return 0;
+        length += LZ4_MIN_MATCH;
+        if(dstSize - pos < length) return 0;
+
+        if(dst != NULL) copyForward(dst + pos, dst + pos - offset, length);
+        pos += length;
+    }
+
+    return pos;
+}
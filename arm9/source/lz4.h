@@ -0,0 +1,8 @@
+#pragma once
+
+#include "types.h"
+
+// Decodes an LZ4 block (no frame header) of srcSize bytes into at most dstSize bytes.
+// Returns the decoded size, or 0 if the block is malformed or doesn't fit.
+// With dst == NULL the block is only checked, nothing is written.
+u32 lz4Decompress(u8 *dst, u32 dstSize, const u8 *src, u32 srcSize);
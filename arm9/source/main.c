@@ -1,7 +1,9 @@
-#include "fs.c" // mountSdCardPartition
+#include "fs.h" // mountSdCardPartition
 #include "i2c.h" // I2C_init
 #include "firm.h" // loadHomebrewFirm
 #include "utils.h" // error mcuSetInfoLedPattern
+#include "trace.h" // traceStage
+#include "timer.h" // timerInit
 
 extern u8 __itcm_start__[], __itcm_lma__[], __itcm_bss_start__[], __itcm_end__[];
 
@@ -10,6 +12,9 @@ void main(){
     memcpy(__itcm_start__, __itcm_lma__, __itcm_bss_start__ - __itcm_start__);
     memset(__itcm_bss_start__, 0, __itcm_end__ - __itcm_bss_start__);
 
+    timerInit();
+    traceStage(STAGE_START);
+
     // ioの初期化
     I2C_init();
 
@@ -31,37 +31,129 @@
 
 #include "memory.h"
 
-u8 *memsearch(u8 *startPos, const void *pattern, u32 size, u32 patternSize)
+bool patternSetInit(PatternSet *set, const void *const *patterns, const u32 *sizes, u32 count)
 {
-    const u8 *patternc = (const u8 *)pattern;
-    u32 table[256];
+    if(count == 0 || count > PATTERN_SET_MAX) return false;
+
+    set->count = count;
+    set->minSize = 0xFFFFFFFF;
+    for(u32 i = 0; i < count; i++)
+    {
+        if(sizes[i] == 0) return false;
+
+        set->patterns[i] = (const u8 *)patterns[i];
+        set->sizes[i] = sizes[i];
+        if(sizes[i] < set->minSize) set->minSize = sizes[i];
+    }
+
+    u32 window = set->minSize < 255 ? set->minSize : 255;
+    set->window = window;
 
-    //Preprocessing
+    //Preprocessing: the smallest shift any pattern allows for each byte
     for(u32 i = 0; i < 256; i++)
-        table[i] = patternSize;
-    for(u32 i = 0; i < patternSize - 1; i++)
-        table[patternc[i]] = patternSize - i - 1;
+        set->shift[i] = (u8)window;
+    for(u32 i = 0; i < count; i++)
+        for(u32 j = 0; j < window - 1; j++)
+            if(window - j - 1 < set->shift[set->patterns[i][j]]) set->shift[set->patterns[i][j]] = (u8)(window - j - 1);
+
+    memcpy(set->skip, set->shift, sizeof(set->skip));
+    for(u32 i = 0; i < count; i++)
+        set->skip[set->patterns[i][window - 1]] = 0;
+
+    return true;
+}
+
+//Returns the first match in the data; when several patterns match there, the one added first.
+//index, if not NULL, receives which pattern it was.
+u8 *patternSetSearch(const PatternSet *set, u8 *startPos, u32 size, u32 *index)
+{
+    if(size < set->minSize) return NULL;
+
+    const u8 *last = startPos + set->window - 1;
+    u32 window = set->window,
+        end = size - set->minSize,
+        j = 0;
 
-    //Searching
-    u32 j = 0;
-    while(j <= size - patternSize)
+    while(j <= end)
     {
-        u8 c = startPos[j + patternSize - 1];
-        if(patternc[patternSize - 1] == c && memcmp(pattern, startPos + j, patternSize - 1) == 0)
-            return startPos + j;
-        j += table[c];
+        //Skip loop: four lookups per round while no pattern can end at the window's last byte.
+        //Every shift is at most window bytes, so the unrolled reads stay within the data.
+        if(end >= 3 * window)
+        {
+            while(j <= end - 3 * window)
+            {
+                u32 s;
+                if((s = set->skip[last[j]]) == 0) break;
+                j += s;
+                if((s = set->skip[last[j]]) == 0) break;
+                j += s;
+                if((s = set->skip[last[j]]) == 0) break;
+                j += s;
+                if((s = set->skip[last[j]]) == 0) break;
+                j += s;
+            }
+        }
+
+        u32 s;
+        while(j <= end && (s = set->skip[last[j]]) != 0) j += s;
+        if(j > end) break;
+
+        //Searching: check the patterns that end the window with this byte
+        u8 c = last[j];
+        for(u32 i = 0; i < set->count; i++)
+        {
+            const u8 *pattern = set->patterns[i];
+
+            if(pattern[window - 1] == c && set->sizes[i] <= size - j && memcmp(pattern, startPos + j, set->sizes[i]) == 0)
+            {
+                if(index != NULL) *index = i;
+                return startPos + j;
+            }
+        }
+
+        j += set->shift[c];
     }
 
     return NULL;
 }
 
+u8 *memsearch(u8 *startPos, const void *pattern, u32 size, u32 patternSize)
+{
+    PatternSet set;
+
+    if(!patternSetInit(&set, &pattern, &patternSize, 1)) return NULL;
+
+    return patternSetSearch(&set, startPos, size, NULL);
+}
+
 void *copyFromLegacyModeFcram(void *dst, const void *src, size_t size)
 {
     // Copy 2 bytes with a stride of 8
     const u16 *src16 = (const u16 *)src;
     u16 *dst16 = (u16 *)dst;
+    size_t count = size / 2, i = 0;
+
+    // Both word aligned: the halfwords come from the low half of every other word, eight per 64 source
+    // bytes, and go out as four whole words. Only the words needed are loaded; the line fill on the first
+    // brings in the rest.
+    if((((uintptr_t)src | (uintptr_t)dst) & 3) == 0)
+    {
+        const u32 *src32 = (const u32 *)src;
+        u32 *dst32 = (u32 *)dst;
 
-    for (size_t i = 0; i < size / 2; i++)
+        for(; i + 8 <= count; i += 8, src32 += 16, dst32 += 4)
+        {
+            u32 w0 = src32[0], w2 = src32[2], w4 = src32[4], w6 = src32[6],
+                w8 = src32[8], w10 = src32[10], w12 = src32[12], w14 = src32[14];
+
+            dst32[0] = (w0 & 0xFFFF) | w2 << 16;
+            dst32[1] = (w4 & 0xFFFF) | w6 << 16;
+            dst32[2] = (w8 & 0xFFFF) | w10 << 16;
+            dst32[3] = (w12 & 0xFFFF) | w14 << 16;
+        }
+    }
+
+    for (; i < count; i++)
         dst16[i] = src16[4 * i];
 
     return dst;
@@ -72,8 +164,31 @@ void *copyToLegacyModeFcram(void *dst, const void *src, size_t size)
     // Copy 2 bytes with a stride of 8
     const u16 *src16 = (const u16 *)src;
     u16 *dst16 = (u16 *)dst;
+    size_t count = size / 2, i = 0;
+
+    // Word aligned source: eight halfwords read as four words per round, then stored one by one, since
+    // the bytes between them must be left alone
+    if(((uintptr_t)src & 3) == 0)
+    {
+        const u32 *src32 = (const u32 *)src;
+
+        for(; i + 8 <= count; i += 8, src32 += 4)
+        {
+            u32 w0 = src32[0], w1 = src32[1], w2 = src32[2], w3 = src32[3];
+            u16 *out = dst16 + 4 * i;
+
+            out[0] = (u16)w0;
+            out[4] = (u16)(w0 >> 16);
+            out[8] = (u16)w1;
+            out[12] = (u16)(w1 >> 16);
+            out[16] = (u16)w2;
+            out[20] = (u16)(w2 >> 16);
+            out[24] = (u16)w3;
+            out[28] = (u16)(w3 >> 16);
+        }
+    }
 
-    for (size_t i = 0; i < size / 2; i++)
+    for (; i < count; i++)
         dst16[4 * i] = src16[i];
 
     return dst;
@@ -33,6 +33,23 @@
 #include <string.h>
 #include "types.h"
 
+#define PATTERN_SET_MAX 8
+
+//Patterns compiled for a multi-pattern Horspool search (one pass over the data for all of them).
+//The shift tables look at a window as long as the shortest pattern, capped at 255 bytes.
+typedef struct
+{
+    const u8 *patterns[PATTERN_SET_MAX];
+    u32 sizes[PATTERN_SET_MAX];
+    u32 count;
+    u32 minSize;
+    u32 window;
+    u8 shift[256]; //by the window's last byte
+    u8 skip[256];  //the same, but 0 where some pattern has that byte at the end of the window
+} PatternSet;
+
+bool patternSetInit(PatternSet *set, const void *const *patterns, const u32 *sizes, u32 count);
+u8 *patternSetSearch(const PatternSet *set, u8 *startPos, u32 size, u32 *index);
 u8 *memsearch(u8 *startPos, const void *pattern, u32 size, u32 patternSize);
 void *copyFromLegacyModeFcram(void *dst, const void *src, size_t size);
 void *copyToLegacyModeFcram(void *dst, const void *src, size_t size);
@@ -0,0 +1,146 @@
+/*
+*   Memory to memory transfers on the ARM9 NDMA engine, in immediate mode.
+*   Used by the chainloader for section copies, so it lives in ITCM.
+*/
+
+#include "ndma.h"
+#include "cache.h"
+
+// No copy loops here yet, but ndmaCopy runs mid-copy like the rest of the ITCM code (see linker.ld)
+#pragma GCC optimize ("no-tree-loop-distribute-patterns")
+
+//Destination of each channel's transfer, invalidated in ndmaWait
+static struct
+{
+    u32 dst, size;
+} pending[NDMA_CHANNELS];
+
+#ifdef NDMA_REG_HOOKS
+static inline u32 ndma_read32(u32 reg)
+{
+    return ndma_hook_read32(reg);
+}
+
+static inline void ndma_write32(u32 reg, u32 val)
+{
+    ndma_hook_write32(reg, val);
+}
+#else
+static inline u32 ndma_read32(u32 reg)
+{
+    return *(vu32 *)(NDMA_BASE + reg);
+}
+
+static inline void ndma_write32(u32 reg, u32 val)
+{
+    *(vu32 *)(NDMA_BASE + reg) = val;
+}
+#endif
+
+static inline u32 toAddress(const void *p)
+{
+    return (u32)(uintptr_t)p;
+}
+
+//ITCM (and its mirrors) and DTCM/boot ROM are on the CPU side of the bus
+static bool isReachable(u32 address, u32 size)
+{
+    return address >= 0x08000000 && address < 0xFFF00000 && size <= 0xFFF00000 - address;
+}
+
+//Largest burst (up to 16 words) the word count is a multiple of
+static u32 blockSize(u32 words)
+{
+    u32 log2 = 0;
+
+    while(log2 < 4 && (words & ((2u << log2) - 1)) == 0) log2++;
+
+    return NDMA_BLOCK_WORDS(log2);
+}
+
+static bool canTransfer(u32 channel, u32 dst, u32 size)
+{
+    return channel < NDMA_CHANNELS && size != 0 && size <= NDMA_MAX_SIZE && ((dst | size) & 3) == 0 &&
+           isReachable(dst, size) && !ndmaBusy(channel);
+}
+
+static void start(u32 channel, u32 dst, u32 size, u32 srcMode)
+{
+    u32 base = NDMA_CHANNEL(channel);
+
+    //Dirty lines over the destination would otherwise be written back over the transferred data later
+    flushDCacheRange((void *)dst, size);
+    pending[channel].dst = dst;
+    pending[channel].size = size;
+
+    ndma_write32(base + NDMA_DAD, dst);
+    ndma_write32(base + NDMA_WCNT, size / 4);
+    ndma_write32(base + NDMA_BCNT, 0);
+    ndma_write32(base + NDMA_CNT, NDMA_ENABLE | NDMA_IMMEDIATE_MODE | blockSize(size / 4) | srcMode | NDMA_DST_INCREMENT);
+}
+
+void ndmaInit(void)
+{
+    for(u32 i = 0; i < NDMA_CHANNELS; i++)
+        ndma_write32(NDMA_CHANNEL(i) + NDMA_CNT, 0);
+    ndma_write32(NDMA_GCNT, NDMA_GCNT_ENABLE);
+}
+
+bool ndmaCopyAsync(u32 channel, void *dst, const void *src, u32 size)
+{
+    u32 dstAddress = toAddress(dst), srcAddress = toAddress(src);
+
+    if(!canTransfer(channel, dstAddress, size) || (srcAddress & 3) != 0 || !isReachable(srcAddress, size) ||
+       (dstAddress < srcAddress + size && srcAddress < dstAddress + size)) return false;
+
+    cleanDCacheRange(src, size);
+    ndma_write32(NDMA_CHANNEL(channel) + NDMA_SAD, srcAddress);
+    start(channel, dstAddress, size, NDMA_SRC_INCREMENT);
+
+    return true;
+}
+
+bool ndmaFillAsync(u32 channel, void *dst, u32 value, u32 size)
+{
+    u32 dstAddress = toAddress(dst);
+
+    if(!canTransfer(channel, dstAddress, size)) return false;
+
+    ndma_write32(NDMA_CHANNEL(channel) + NDMA_FDATA, value);
+    start(channel, dstAddress, size, NDMA_SRC_FILL);
+
+    return true;
+}
+
+bool ndmaBusy(u32 channel)
+{
+    return (ndma_read32(NDMA_CHANNEL(channel) + NDMA_CNT) & NDMA_ENABLE) != 0;
+}
+
+void ndmaWait(u32 channel)
+{
+    while(ndmaBusy(channel));
+
+    //Lines the CPU pulled in meanwhile (neighbouring data sharing the first or last line) are stale
+    if(pending[channel].size != 0)
+    {
+        invalidateDCacheRange((void *)pending[channel].dst, pending[channel].size);
+        pending[channel].size = 0;
+    }
+}
+
+bool ndmaCopy(u32 channel, void *dst, const void *src, u32 size)
+{
+    if(!ndmaCopyAsync(channel, dst, src, size)) return false;
+    ndmaWait(channel);
+
+    return true;
+}
+
+bool ndmaFill(u32 channel, void *dst, u32 value, u32 size)
+{
+    if(!ndmaFillAsync(channel, dst, value, size)) return false;
+    ndmaWait(channel);
+
+    return true;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "types.h"
+
+#define NDMA_BASE           0x10002000
+#define NDMA_CHANNELS       8
+
+#define NDMA_GCNT           0x00
+#define NDMA_CHANNEL(n)     (0x04 + (n) * 0x1C)
+#define NDMA_SAD            0x00
+#define NDMA_DAD            0x04
+#define NDMA_TCNT           0x08
+#define NDMA_WCNT           0x0C
+#define NDMA_BCNT           0x10
+#define NDMA_FDATA          0x14
+#define NDMA_CNT            0x18
+
+#define NDMA_GCNT_ENABLE        1u
+#define NDMA_DST_INCREMENT      (0u << 10)
+#define NDMA_SRC_INCREMENT      (0u << 13)
+#define NDMA_SRC_FILL           (3u << 13)
+#define NDMA_BLOCK_WORDS(log2)  ((u32)(log2) << 16)
+#define NDMA_IMMEDIATE_MODE     (1u << 28)
+#define NDMA_IRQ_ENABLE         (1u << 30)
+#define NDMA_ENABLE             (1u << 31)
+
+#define NDMA_MAX_SIZE       (0xFFFFFFu * 4) //WCNT is 24-bit
+
+#ifdef NDMA_REG_HOOKS
+//Register accesses go through these instead of MMIO (e.g. to the host-side NDMA model)
+u32 ndma_hook_read32(u32 reg);
+void ndma_hook_write32(u32 reg, u32 val);
+#endif
+
+// Transfers are word based and can't reach the TCMs. The copy and fill calls return false, without
+// starting anything, for unaligned or overlapping ranges, sizes over NDMA_MAX_SIZE and TCM addresses;
+// the caller copies with the CPU then.
+// The data cache is cleaned and invalidated around the transfer. Until ndmaWait returns, the CPU must
+// not write the destination or the rest of its first and last cache lines, nor write the source.
+void ndmaInit(void);
+bool ndmaCopyAsync(u32 channel, void *dst, const void *src, u32 size);
+bool ndmaFillAsync(u32 channel, void *dst, u32 value, u32 size);
+bool ndmaBusy(u32 channel);
+void ndmaWait(u32 channel);
+
+// Start and wait in one go
+bool ndmaCopy(u32 channel, void *dst, const void *src, u32 size);
+bool ndmaFill(u32 channel, void *dst, u32 value, u32 size);
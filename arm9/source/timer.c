@@ -0,0 +1,99 @@
+/*
+*   Monotonic clock on the ARM9 timers. Timer 0 counts bus clock cycles,
+*   timers 1 and 2 count its overflows; timer 3 stays free.
+*/
+
+#include "timer.h"
+#if defined(SDMMC_USE_IRQ) || defined(I2C_USE_IRQ)
+#include "irq.h"
+#endif
+
+static bool isStarted;
+static u64 lastTicks;
+
+void timerInit(void)
+{
+    if(isStarted) return;
+
+    for(u32 i = 0; i < 3; i++)
+    {
+        REG_TIMER_CNT(i) = 0;
+        REG_TIMER_VAL(i) = 0;
+    }
+
+    //Start the high timers first, so they see every overflow of the one below
+    REG_TIMER_CNT(2) = TIMER_ENABLE | TIMER_COUNT_UP;
+    REG_TIMER_CNT(1) = TIMER_ENABLE | TIMER_COUNT_UP;
+    REG_TIMER_CNT(0) = TIMER_ENABLE | TIMER_PRESCALER_1;
+
+    lastTicks = 0;
+    isStarted = true;
+}
+
+u64 timerTicks(void)
+{
+    u16 high, middle, low;
+
+    //The halves are read one at a time: retry if a carry reached the upper ones meanwhile
+    do
+    {
+        high = REG_TIMER_VAL(2);
+        middle = REG_TIMER_VAL(1);
+        low = REG_TIMER_VAL(0);
+    }
+    while(high != REG_TIMER_VAL(2) || middle != REG_TIMER_VAL(1));
+
+    u64 ticks = (lastTicks & ~0xFFFFFFFFFFFFULL) | (u64)high << 32 | (u32)middle << 16 | low;
+
+    if(ticks < lastTicks) ticks += 1ULL << 48;
+    lastTicks = ticks;
+
+    return ticks;
+}
+
+void timerWaitUntil(u64 deadline)
+{
+    while(!timerExpired(deadline));
+}
+
+#if defined(SDMMC_USE_IRQ) || defined(I2C_USE_IRQ)
+static volatile bool hasOverflowed;
+
+static void timerOverflowIrqHandler(void)
+{
+    hasOverflowed = true;
+}
+
+// Timer 0 interrupts on every overflow only for the length of the sleep. Its enable bit stays set
+// while the control register is rewritten, so the count isn't reloaded and the clock runs on.
+void timerSleepUntil(u64 deadline)
+{
+    irqInit();
+    irqRegister(IRQ_TIMER(0), timerOverflowIrqHandler);
+    REG_TIMER_CNT(0) = TIMER_ENABLE | TIMER_IRQ_ENABLE | TIMER_PRESCALER_1;
+
+    while(!timerExpired(deadline))
+    {
+        hasOverflowed = false;
+        irqWaitFor(&hasOverflowed);
+    }
+
+    REG_TIMER_CNT(0) = TIMER_ENABLE | TIMER_PRESCALER_1;
+    irqRegister(IRQ_TIMER(0), NULL);
+}
+#else
+void timerSleepUntil(u64 deadline)
+{
+    timerWaitUntil(deadline);
+}
+#endif
+
+void timerWaitUs(u64 us)
+{
+    timerWaitUntil(timerTicks() + timerUsToTicks(us));
+}
+
+void timerWaitMs(u64 ms)
+{
+    timerWaitUntil(timerTicks() + timerMsToTicks(ms));
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "types.h"
+
+#define TICKS_PER_SEC       67027964ULL //timer 0 runs at the bus clock, prescaler 1
+
+#define REG_TIMER_VAL(i)    (*(vu16 *)(0x10003000 + 4 * (i)))
+#define REG_TIMER_CNT(i)    (*(vu16 *)(0x10003002 + 4 * (i)))
+
+#define TIMER_PRESCALER_1   0
+#define TIMER_COUNT_UP      (1u << 2)
+#define TIMER_IRQ_ENABLE    (1u << 6)
+#define TIMER_ENABLE        (1u << 7)
+
+#define TIMER_FREE          3 //not part of the clock, left for users that need an interrupt
+
+// Timers 0-2 cascaded into a 48-bit counter, extended to 64 bits in software. Safe to call again.
+void timerInit(void);
+// Ticks since timerInit, monotonic as long as it is called at least once every 48 days
+u64 timerTicks(void);
+
+// Exact conversions; the ones to ticks round up, so a wait is never shorter than asked for
+static inline u64 timerUsToTicks(u64 us)
+{
+    return (us * TICKS_PER_SEC + 999999) / 1000000;
+}
+
+static inline u64 timerMsToTicks(u64 ms)
+{
+    return (ms * TICKS_PER_SEC + 999) / 1000;
+}
+
+static inline u64 timerTicksToUs(u64 ticks)
+{
+    return ticks * 1000000 / TICKS_PER_SEC;
+}
+
+static inline u64 timerTicksToMs(u64 ticks)
+{
+    return ticks * 1000 / TICKS_PER_SEC;
+}
+
+// Deadlines are absolute tick counts, so loops converting nothing per iteration can check them
+static inline u64 timerDeadlineMs(u64 ms)
+{
+    return timerTicks() + timerMsToTicks(ms);
+}
+
+static inline bool timerExpired(u64 deadline)
+{
+    return timerTicks() >= deadline;
+}
+
+void timerWaitUntil(u64 deadline);
+// Like timerWaitUntil, but with SDMMC_USE_IRQ or I2C_USE_IRQ the CPU sleeps between timer 0 overflows
+// (every 65536 ticks, about 0.98 ms), so it returns at the first overflow or other interrupt past the deadline
+void timerSleepUntil(u64 deadline);
+void timerWaitUs(u64 us);
+void timerWaitMs(u64 ms);
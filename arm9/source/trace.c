@@ -0,0 +1,121 @@
+#include "trace.h"
+#include "utils.h"
+#include "fmt.h"
+#include "fatfs/ff.h"
+#include "fatfs/sdmmc/sdmmc.h"
+
+BootTrace bootTrace;
+
+static const char *stageNames[STAGE_COUNT] = {
+    "start", "sd_init", "mount", "scan", "menu", "read", "launch"
+};
+
+void traceStage(BootStage stage)
+{
+    bootTrace.stageTicks[stage] = timerTicks();
+    bootTrace.stageMask |= 1u << stage;
+}
+
+// Duration of a stage, measured from the end of the latest earlier stage that was reached
+u64 traceStageTicks(BootStage stage)
+{
+    if(!(bootTrace.stageMask & (1u << stage))) return 0;
+
+    u64 begin = 0;
+    for(s32 i = (s32)stage - 1; i >= 0; i--)
+    {
+        if(bootTrace.stageMask & (1u << i))
+        {
+            begin = bootTrace.stageTicks[i];
+            break;
+        }
+    }
+
+    return bootTrace.stageTicks[stage] - begin;
+}
+
+#ifdef BOOT_TRACE_LOG
+// Offset of the first zero byte of a preallocated log, i.e. where the next record goes.
+// Records are only ever appended, so a binary search on the first byte of each sector finds it.
+static FSIZE_t findLogEnd(FIL *file)
+{
+    char sector[0x200];
+    UINT read;
+    u32 lo = 0, hi = BOOT_LOG_MAX_SIZE / sizeof(sector);
+
+    while(lo < hi)
+    {
+        u32 mid = (lo + hi) / 2;
+        if(f_lseek(file, mid * sizeof(sector)) != FR_OK || f_read(file, sector, 1, &read) != FR_OK || read != 1)
+            return BOOT_LOG_MAX_SIZE;
+
+        if(sector[0] == 0) hi = mid;
+        else lo = mid + 1;
+    }
+
+    if(lo == 0) return 0;
+
+    if(f_lseek(file, (lo - 1) * sizeof(sector)) != FR_OK || f_read(file, sector, sizeof(sector), &read) != FR_OK)
+        return BOOT_LOG_MAX_SIZE;
+
+    u32 i = 0;
+    while(i < read && sector[i] != 0) i++;
+
+    return (lo - 1) * sizeof(sector) + i;
+}
+
+void writeBootLog(void)
+{
+    // Every line has a bounded length, so one record always fits in buf
+    char buf[0x400];
+    char *pos = buf;
+    const sdmmcstats *sdStats = sdmmc_get_stats();
+
+    pos += sprintf(pos, "boot\n");
+    for(u32 i = 0; i < STAGE_COUNT; i++)
+    {
+        if(!(bootTrace.stageMask & (1u << i))) continue;
+        pos += sprintf(pos, "stage %s %llu\n", stageNames[i], timerTicksToUs(bootTrace.stageTicks[i]));
+    }
+    pos += sprintf(pos, "io read_calls=%lu sectors_read=%lu write_calls=%lu sectors_written=%lu write_cache_hits=%lu commands=%lu\n",
+                   bootTrace.readCalls, bootTrace.sectorsRead, bootTrace.writeCalls, bootTrace.sectorsWritten,
+                   bootTrace.writeCacheHits, sdStats->commands);
+    pos += sprintf(pos, "sdmmc errors=%lu retries=%lu reinits=%lu slowdowns=%lu clock=%lu last_error=0x%lx last_stat1=0x%x last_cmd=0x%x\n",
+                   sdStats->errors, sdStats->retries, sdStats->reinits, sdStats->slowdowns, sdmmc_sdcard_clock(),
+                   sdStats->lasterror, sdStats->laststat1, sdStats->lastcmd);
+    u64 readUs = timerTicksToUs(bootTrace.lastReadTicks);
+    pos += sprintf(pos, "payload_read bytes=%lu us=%llu kib_per_s=%llu\n", bootTrace.lastReadBytes, readUs,
+                   readUs != 0 ? (u64)bootTrace.lastReadBytes * 1000000 / 1024 / readUs : 0);
+    pos += sprintf(pos, "end\n");
+
+    FIL file;
+    if(f_open(&file, BOOT_LOG_PATH, FA_READ | FA_WRITE | FA_OPEN_ALWAYS) != FR_OK) return;
+
+    FSIZE_t end = f_size(&file);
+
+    // Larger logs, preallocated by older builds, would never take another record, so they start over
+    if(end > BOOT_LOG_MAX_SIZE && f_truncate(&file) == FR_OK) end = 0;
+
+    if(end == 0 && f_expand(&file, BOOT_LOG_MAX_SIZE, 1) == FR_OK)
+    {
+        // New log: one contiguous zero filled run, so later records rewrite data sectors in place
+        char zeros[0x200] = {0};
+        UINT written;
+        for(u32 i = 0; i < BOOT_LOG_MAX_SIZE / sizeof(zeros); i++) f_write(&file, zeros, sizeof(zeros), &written);
+    }
+    else if(end == BOOT_LOG_MAX_SIZE) end = findLogEnd(&file);
+
+    // Never grown past BOOT_LOG_MAX_SIZE (logs from older builds were grown as they were written)
+    if(end + (u32)(pos - buf) <= BOOT_LOG_MAX_SIZE && f_lseek(&file, end) == FR_OK)
+    {
+        UINT written;
+        f_write(&file, buf, (UINT)(pos - buf), &written);
+    }
+
+    f_close(&file);
+}
+#else
+void writeBootLog(void)
+{
+}
+#endif
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "types.h"
+
+#define BOOT_LOG_PATH       "/luma/chainloader.log"
+#define BOOT_LOG_MAX_SIZE   0x2000 // new logs are preallocated to this size, none is grown past it
+
+// Boot stages, in the order they complete. Each mark is the time the stage ended.
+typedef enum
+{
+    STAGE_START = 0,
+    STAGE_SD_INIT,
+    STAGE_MOUNT,
+    STAGE_SCAN,
+    STAGE_MENU,
+    STAGE_READ,
+    STAGE_LAUNCH,
+    STAGE_COUNT
+} BootStage;
+
+typedef struct
+{
+    u64 stageTicks[STAGE_COUNT];
+    u32 stageMask;
+
+    // diskio counters
+    u32 readCalls;
+    u32 sectorsRead;
+    u32 writeCalls;
+    u32 sectorsWritten;
+    u32 writeCacheHits; // single sector writes merged into an already cached sector
+
+    // last fileRead() or fileReadExtents(), i.e. the payload; logged as its read rate
+    u32 lastReadBytes;
+    u64 lastReadTicks;
+} BootTrace;
+
+extern BootTrace bootTrace;
+
+void traceStage(BootStage stage);
+u64 traceStageTicks(BootStage stage);
+void writeBootLog(void);
@@ -48,49 +48,95 @@ typedef struct McuInfoLedPattern {
 } McuInfoLedPattern;
 _Static_assert(sizeof(McuInfoLedPattern) == 100, "McuInfoLedPattern: wrong size");
 
+#define KEY_DEBOUNCE_MS     5    //a new key must stay pressed this long
+#define INPUT_SAMPLE_US     1000 //HID_PAD sampling period
+#define MCU_POLL_MS         25   //one MCU status read per period while no key is pressed
+
+#define MCU_REG_BATTERY     0x0B
+#define MCU_REG_POWER_STATE 0x0F
+#define MCU_REG_INTERRUPTS  0x10
+
+bool mcuReadStatus(McuStatus *status)
+{
+    static const u8 regs[] = { MCU_REG_BATTERY, MCU_REG_POWER_STATE, MCU_REG_INTERRUPTS };
+    u8 values[sizeof(regs)];
+
+    if(!I2C_readRegList(I2C_DEV_MCU, regs, values, sizeof(regs))) return false;
+
+    status->batteryPercent = values[0];
+    status->powerState = values[1];
+    status->interrupts = values[2];
+
+    return true;
+}
+
+static void pollMcu(bool shouldShellShutdown)
+{
+    McuStatus status;
+
+    if(!mcuReadStatus(&status)) return;
+
+    if(shouldShellShutdown && !(status.powerState & 2)) mcuPowerOff();
+    if(status.interrupts & 1) mcuPowerOff(); //Power button pressed
+}
+
 u32 waitInput(bool isMenu)
 {
     static u64 dPadDelay = 0ULL;
-    u64 initialValue = 0ULL;
+    const u64 samplePeriod = timerUsToTicks(INPUT_SAMPLE_US),
+              mcuPeriod = timerMsToTicks(MCU_POLL_MS);
+    u64 now = timerTicks(),
+        repeatDeadline = 0ULL,
+        debounceDeadline = 0ULL,
+        nextSample = now,
+        nextMcuPoll = now;
     u32 key,
-        oldKey = HID_PAD;
+        oldKey = HID_PAD,
+        candidate = 0;
     bool shouldShellShutdown = true;
 
     if(isMenu)
     {
         dPadDelay = dPadDelay > 0ULL ? 87ULL : 143ULL;
-        startChrono();
-        initialValue = chrono();
+        repeatDeadline = now + timerMsToTicks(dPadDelay);
     }
 
     while(true)
     {
+        //Asleep between samples where interrupts are available. The wake-up may be up to a timer overflow
+        //late, so samples are scheduled from the previous deadline unless that has fallen a period behind.
+        timerSleepUntil(nextSample);
+        now = timerTicks();
+        nextSample = nextSample + samplePeriod > now ? nextSample + samplePeriod : now + samplePeriod;
         key = HID_PAD;
 
         if(!key)
         {
-            if(shouldShellShutdown)
+            if(now >= nextMcuPoll)
             {
-                u8 shellState = I2C_readReg(I2C_DEV_MCU, 0xF);
-                wait(5);
-                if(!(shellState & 2)) mcuPowerOff();
+                pollMcu(shouldShellShutdown);
+                nextMcuPoll = timerTicks() + mcuPeriod;
             }
 
-            u8 intStatus = I2C_readReg(I2C_DEV_MCU, 0x10);
-            wait(5);
-            if(intStatus & 1) mcuPowerOff(); //Power button pressed
-
             oldKey = 0;
             dPadDelay = 0;
+            candidate = 0;
             continue;
         }
 
-        if(key == oldKey && (!isMenu || (!(key & DPAD_BUTTONS) || chrono() - initialValue < dPadDelay))) continue;
+        if(key == oldKey && (!isMenu || (!(key & DPAD_BUTTONS) || now < repeatDeadline)))
+        {
+            candidate = 0;
+            continue;
+        }
 
-        //Make sure the key is pressed
-        u32 i;
-        for(i = 0; i < 0x13000 && key == HID_PAD; i++);
-        if(i == 0x13000) break;
+        //Make sure the key is pressed: the same keys in every sample over the debounce period
+        if(key != candidate)
+        {
+            candidate = key;
+            debounceDeadline = now + timerMsToTicks(KEY_DEBOUNCE_MS);
+        }
+        else if(now >= debounceDeadline) break;
     }
 
     return key;
@@ -98,11 +144,7 @@ u32 waitInput(bool isMenu)
 
 void wait(u64 amount)
 {
-    startChrono();
-
-    u64 initialValue = chrono();
-
-    while(chrono() - initialValue < amount);
+    timerWaitMs(amount);
 }
 
 void error(const char *fmt, ...)
@@ -111,7 +153,7 @@ void error(const char *fmt, ...)
 
     va_list args;
     va_start(args, fmt);
-    vsprintf(buf, fmt, args);
+    vsnprintf(buf, sizeof(buf), fmt, args);
     va_end(args);
 
     initScreens();
@@ -134,9 +176,14 @@ static inline u8 mcuPeriodMsToTick(u32 periodMs)
     return (u8)res;
 }
 
+//The pattern last handed to the MCU, and its transfer, which may still be running
+static McuInfoLedPattern ledPattern;
+static I2cTransfer ledTransfer;
+static bool isLedPatternKnown;
+
 void mcuSetInfoLedPattern(u8 r, u8 g, u8 b, u32 periodMs, bool smooth)
 {
-    McuInfoLedPattern pattern;
+    McuInfoLedPattern pattern = {0};
 
     if (periodMs == 0)
     {
@@ -167,5 +214,11 @@ void mcuSetInfoLedPattern(u8 r, u8 g, u8 b, u32 periodMs, bool smooth)
         }
     }
 
-    I2C_writeRegBuf(I2C_DEV_MCU, 0x2D, (const u8 *)&pattern, sizeof(McuInfoLedPattern));
+    //The buffer of the previous write is about to be reused; if that write failed, the LED state is unknown
+    if(isLedPatternKnown && !I2C_wait(&ledTransfer)) isLedPatternKnown = false;
+    if(isLedPatternKnown && memcmp(&pattern, &ledPattern, sizeof(McuInfoLedPattern)) == 0) return;
+
+    ledPattern = pattern;
+    isLedPatternKnown = true;
+    I2C_writeRegBufAsync(&ledTransfer, I2C_DEV_MCU, 0x2D, (const u8 *)&ledPattern, sizeof(McuInfoLedPattern));
 }
\ No newline at end of file
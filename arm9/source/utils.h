@@ -1,9 +1,20 @@
 #pragma once
 
 #include "types.h"
+#include "timer.h"
 
 u32 waitInput(bool isMenu);
 void wait(u64 amount);
 void error(const char *fmt, ...);
 
+typedef struct McuStatus {
+    u8 batteryPercent;
+    u8 powerState;     //bit 1: shell open
+    u8 interrupts;     //bit 0: power button pressed; cleared by the read
+} McuStatus;
+
+// Battery, shell and power button in one MCU transaction
+bool mcuReadStatus(McuStatus *status);
+
+// Queues the write and returns; a pattern the same as the current one isn't sent again
 void mcuSetInfoLedPattern(u8 r, u8 g, u8 b, u32 periodMs, bool smooth);
\ No newline at end of file
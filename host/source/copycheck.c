@@ -0,0 +1,119 @@
+/*
+*   Checks the ARM11 memcpy/memset (arm11/source/memory.c) against the C
+*   library on random sizes and source/destination alignments, with guard
+*   bytes around every destination. The ARM11 file is built for this tool
+*   with its functions renamed to arm11Memcpy etc. The legacy mode FCRAM
+*   copies in memory.c are checked the same way against the strided loops
+*   they replace.
+*
+*   usage: copycheck [-n cases] [-s seed]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "memory.h"
+
+#define MAX_SIZE    600u
+#define GUARD       16u
+#define BUF_SIZE    (MAX_SIZE + 2 * GUARD + 8)
+#define WIDE_SIZE   (4 * MAX_SIZE + 2 * GUARD + 8)
+
+void arm11Memcpy(void *dest, const void *src, u32 size);
+void arm11Memset(void *dest, u32 filler, u32 size);
+
+static u64 rngState;
+
+static u32 rnd(u32 n)
+{
+    rngState = rngState * 6364136223846793005ULL + 1442695040888963407ULL;
+    return n ? (u32)(rngState >> 33) % n : 0;
+}
+
+static void referenceFromLegacy(void *dst, const void *src, size_t size)
+{
+    for(size_t i = 0; i < size / 2; i++) ((u16 *)dst)[i] = ((const u16 *)src)[4 * i];
+}
+
+static void referenceToLegacy(void *dst, const void *src, size_t size)
+{
+    for(size_t i = 0; i < size / 2; i++) ((u16 *)dst)[4 * i] = ((const u16 *)src)[i];
+}
+
+//Mostly short sizes around the alignment and block boundaries, sometimes long ones
+static u32 randomSize(void)
+{
+    return rnd(2) ? rnd(80) : rnd(MAX_SIZE + 1);
+}
+
+int main(int argc, char **argv)
+{
+    u32 cases = 200000, seed = 1;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "-n") == 0 && i + 1 < argc) cases = (u32)strtoul(argv[++i], NULL, 0);
+        else if(strcmp(argv[i], "-s") == 0 && i + 1 < argc) seed = (u32)strtoul(argv[++i], NULL, 0);
+        else
+        {
+            fprintf(stderr, "usage: %s [-n cases] [-s seed]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    rngState = seed;
+
+    static u8 src[BUF_SIZE] __attribute__((aligned(32))), expected[BUF_SIZE] __attribute__((aligned(32))),
+              actual[BUF_SIZE] __attribute__((aligned(32)));
+    static u8 wideSrc[WIDE_SIZE] __attribute__((aligned(32))), wideExpected[WIDE_SIZE] __attribute__((aligned(32))),
+              wideActual[WIDE_SIZE] __attribute__((aligned(32)));
+    u32 copyFailures = 0, setFailures = 0, fcramFailures = 0;
+
+    for(u32 n = 0; n < cases; n++)
+    {
+        u32 size = randomSize(), srcOffset = GUARD + rnd(8), dstOffset = GUARD + rnd(8);
+
+        for(u32 i = 0; i < BUF_SIZE; i++)
+        {
+            src[i] = (u8)rnd(256);
+            expected[i] = actual[i] = (u8)rnd(256);
+        }
+
+        memcpy(expected + dstOffset, src + srcOffset, size);
+        arm11Memcpy(actual + dstOffset, src + srcOffset, size);
+        if(memcmp(expected, actual, BUF_SIZE) != 0 && copyFailures++ < 10)
+            printf("memcpy: %u bytes, src +%u, dst +%u differs\n", size, srcOffset & 7, dstOffset & 7);
+
+        //Only the low byte of the filler counts, as with the C library
+        u32 filler = rnd(2) ? rnd(256) : (u32)rnd(0x10000) << 16 | rnd(0x10000);
+        memset(expected + dstOffset, (u8)filler, size);
+        arm11Memset(actual + dstOffset, filler, size);
+        if(memcmp(expected, actual, BUF_SIZE) != 0 && setFailures++ < 10)
+            printf("memset: %u bytes of 0x%02x, dst +%u differs\n", size, filler & 0xFF, dstOffset & 7);
+
+        //Strided side on the wide buffers; offsets stay even, the functions work in halfwords
+        srcOffset &= ~1u;
+        dstOffset &= ~1u;
+        memcpy(actual, expected, BUF_SIZE);
+        for(u32 i = 0; i < WIDE_SIZE; i++)
+        {
+            wideSrc[i] = (u8)rnd(256);
+            wideExpected[i] = wideActual[i] = (u8)rnd(256);
+        }
+
+        referenceFromLegacy(expected + dstOffset, wideSrc + srcOffset, size);
+        copyFromLegacyModeFcram(actual + dstOffset, wideSrc + srcOffset, size);
+        if(memcmp(expected, actual, BUF_SIZE) != 0 && fcramFailures++ < 10)
+            printf("copyFromLegacyModeFcram: %u bytes, src +%u, dst +%u differs\n", size, srcOffset & 7, dstOffset & 7);
+
+        referenceToLegacy(wideExpected + dstOffset, src + srcOffset, size);
+        copyToLegacyModeFcram(wideActual + dstOffset, src + srcOffset, size);
+        if(memcmp(wideExpected, wideActual, WIDE_SIZE) != 0 && fcramFailures++ < 10)
+            printf("copyToLegacyModeFcram: %u bytes, src +%u, dst +%u differs\n", size, srcOffset & 7, dstOffset & 7);
+    }
+
+    printf("copycheck: %u cases, %u memcpy, %u memset and %u legacy FCRAM copy mismatches\n", cases, copyFailures,
+           setFailures, fcramFailures);
+
+    return copyFailures != 0 || setFailures != 0 || fcramFailures != 0;
+}
@@ -0,0 +1,148 @@
+/*
+*   Runs random copies and fills through ndma.c against the register and
+*   cache model in ndma_sim.c, synchronously and with the CPU touching the
+*   neighbouring cache lines while a transfer runs. Requests the engine
+*   turns down are copied by the CPU, as the chainloader does. The arena is
+*   compared with a plain memmove/memset reference after every operation.
+*
+*   usage: dmacheck [-n operations] [-s seed]
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "ndma.h"
+#include "ndma_sim.h"
+
+#define ARENA_ADDRESS   0x20000000u //FCRAM, where the engine can reach
+#define ARENA_SIZE      0x100000u
+#define MAX_TRANSFER    0x8000u
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0
+#endif
+
+static u8 *arena, reference[ARENA_SIZE];
+static u64 rngState;
+
+static u32 rnd(u32 n)
+{
+    rngState = rngState * 6364136223846793005ULL + 1442695040888963407ULL;
+    return n ? (u32)(rngState >> 33) % n : 0;
+}
+
+//Mostly word aligned, like section addresses and sizes
+static u32 randomOffset(u32 limit)
+{
+    u32 offset = rnd(limit);
+    return rnd(8) == 0 ? offset : offset & ~3u;
+}
+
+static u8 *mapArena(void)
+{
+    void *p = mmap((void *)(uintptr_t)ARENA_ADDRESS, ARENA_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+
+    //Anywhere the engine could reach will do
+    if(p == MAP_FAILED || (uintptr_t)p != ARENA_ADDRESS)
+    {
+        if(p != MAP_FAILED) munmap(p, ARENA_SIZE);
+        p = mmap(NULL, ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+    }
+
+    if(p == MAP_FAILED || (uintptr_t)p < 0x08000000 || (uintptr_t)p + ARENA_SIZE > 0xFFF00000) return NULL;
+    return p;
+}
+
+int main(int argc, char **argv)
+{
+    u32 operations = 20000, seed = 1;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "-n") == 0 && i + 1 < argc) operations = (u32)strtoul(argv[++i], NULL, 0);
+        else if(strcmp(argv[i], "-s") == 0 && i + 1 < argc) seed = (u32)strtoul(argv[++i], NULL, 0);
+        else
+        {
+            fprintf(stderr, "usage: %s [-n operations] [-s seed]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    arena = mapArena();
+    if(arena == NULL)
+    {
+        fprintf(stderr, "dmacheck: cannot map the arena below 4 GiB\n");
+        return 2;
+    }
+
+    rngState = seed;
+    for(u32 i = 0; i < ARENA_SIZE; i++) arena[i] = reference[i] = (u8)rnd(256);
+    ndmaSimInit(arena, ARENA_SIZE);
+    ndmaInit();
+
+    u32 copies = 0, fills = 0, cpuCopies = 0, mismatches = 0;
+
+    for(u32 n = 0; n < operations; n++)
+    {
+        u32 channel = rnd(NDMA_CHANNELS), size = randomOffset(MAX_TRANSFER - 4) + 4,
+            dst = randomOffset(ARENA_SIZE - size), src = randomOffset(ARENA_SIZE - size);
+        bool isFill = rnd(4) == 0, isAsync = rnd(2) != 0, isStarted;
+        u32 value = (u32)rnd(0xFFFFFFFF);
+
+        //The CPU has written some of the memory involved since the last transfer
+        u32 touched = randomOffset(ARENA_SIZE - MAX_TRANSFER);
+        ndmaSimCpuRead(arena + touched, MAX_TRANSFER);
+        for(u32 i = 0; i < 64; i++) reference[touched + i] = arena[touched + i] = (u8)rnd(256);
+        ndmaSimCpuWrote(arena + touched, 64);
+        ndmaSimCpuRead(arena + src, size);
+
+        if(isFill)
+        {
+            isStarted = ndmaFillAsync(channel, arena + dst, value, size);
+            for(u32 i = 0; i < size; i++) reference[dst + i] = (u8)(value >> 8 * (i & 3));
+        }
+        else
+        {
+            isStarted = ndmaCopyAsync(channel, arena + dst, arena + src, size);
+            memmove(reference + dst, reference + src, size);
+        }
+
+        if(isStarted)
+        {
+            //Reads around the destination while the engine writes it pull its edge lines into the cache
+            if(isAsync)
+            {
+                if(dst >= 32) ndmaSimCpuRead(arena + dst - 32, 32);
+                if(dst + size + 32 <= ARENA_SIZE) ndmaSimCpuRead(arena + dst + size, 32);
+                while(ndmaBusy(channel));
+            }
+            ndmaWait(channel);
+            isFill ? fills++ : copies++;
+        }
+        else
+        {
+            if(isFill) memcpy(arena + dst, reference + dst, size);
+            else memmove(arena + dst, arena + src, size);
+            ndmaSimCpuWrote(arena + dst, size);
+            cpuCopies++;
+        }
+
+        ndmaSimCpuRead(arena + dst, size);
+        if(memcmp(arena, reference, ARENA_SIZE) != 0)
+        {
+            mismatches++;
+            printf("operation %u: %s of 0x%x bytes to 0x%x on channel %u differs from the reference\n", n,
+                   isFill ? "fill" : "copy", size, dst, channel);
+            memcpy(reference, arena, ARENA_SIZE);
+        }
+    }
+
+    printf("dmacheck:  %u copies, %u fills by DMA, %u turned down and copied by the CPU\n", copies, fills, cpuCopies);
+    ndmaSimPrintStats();
+    printf("%u mismatches, %u cache protocol violations\n", mismatches, ndmaSimViolations());
+
+    return mismatches != 0 || ndmaSimViolations() != 0;
+}
@@ -0,0 +1,247 @@
+/*
+*   Checks the ARM9 formatter (fmt.c) against the C library's snprintf on
+*   random conversions and buffer sizes, then times both on the kinds of
+*   lines the chainloader formats. fmt.c is built for this tool with its
+*   functions renamed to fmtSnprintf etc., so both can be linked together.
+*
+*   usage: fmtcheck [-n cases] [-s seed] [-b iterations]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "types.h"
+
+#define BUF_SIZE 160
+
+typedef int (*SnprintfFn)(char *buf, size_t size, const char *fmt, ...);
+
+int fmtSnprintf(char *buf, size_t size, const char *fmt, ...);
+
+typedef enum
+{
+    ARG_INT = 0,
+    ARG_LLONG,
+    ARG_STRING
+} ArgKind;
+
+typedef struct
+{
+    char fmt[48];
+    ArgKind kind;
+    u32 starCount;
+    int stars[2];
+    long long value;
+    const char *string;
+} Case;
+
+static u64 rngState;
+
+static u32 rnd(u32 n)
+{
+    rngState = rngState * 6364136223846793005ULL + 1442695040888963407ULL;
+    return n ? (u32)(rngState >> 33) % n : 0;
+}
+
+static u64 rnd64(void)
+{
+    u64 value = (u64)rnd(0x10000) << 48 | (u64)rnd(0x1000000) << 24 | rnd(0x1000000);
+    u32 bits = 1 + rnd(64);
+    return bits == 64 ? value : value & ((1ULL << bits) - 1);
+}
+
+//One conversion between literal text, with the flag, width, precision and length combinations C defines
+static void makeCase(Case *c)
+{
+    static const char *convs = "diuxXcs", *strings[] = { "", "a", "luma", "sdmc:/luma/payloads/test.firm" };
+    char conv = convs[rnd(7)], *p = c->fmt;
+    bool isInteger = conv != 'c' && conv != 's';
+
+    if(rnd(2)) *p++ = 'x';
+    *p++ = '%';
+
+    if(rnd(4) == 0) *p++ = '-';
+    if(isInteger)
+    {
+        if(rnd(4) == 0) *p++ = '+';
+        if(rnd(4) == 0) *p++ = ' ';
+        if(rnd(4) == 0) *p++ = '0';
+        if((conv == 'x' || conv == 'X') && rnd(3) == 0) *p++ = '#';
+    }
+
+    c->starCount = 0;
+    switch(rnd(4))
+    {
+        case 1:
+            p += sprintf(p, "%u", rnd(24));
+            break;
+        case 2:
+            *p++ = '*';
+            c->stars[c->starCount++] = (int)rnd(49) - 24;
+            break;
+        default:
+            break;
+    }
+
+    bool hasPrecision = false;
+    if(conv != 'c')
+    {
+        u32 precision = rnd(5);
+
+        hasPrecision = precision != 0;
+        switch(precision)
+        {
+            case 1:
+                *p++ = '.';
+                break;
+            case 2:
+            case 3:
+                p += sprintf(p, ".%u", rnd(24));
+                break;
+            case 4:
+                p += sprintf(p, ".*");
+                c->stars[c->starCount++] = (int)rnd(30) - 5;
+                break;
+            default:
+                break;
+        }
+    }
+
+    c->kind = ARG_INT;
+    if(isInteger)
+    {
+        static const char *lengths[] = { "", "", "hh", "h", "ll" };
+        u32 length = rnd(5);
+
+        p += sprintf(p, "%s", lengths[length]);
+        c->value = (long long)rnd64();
+        if(rnd(2)) c->value = -c->value;
+        if(length == 4) c->kind = ARG_LLONG;
+        else c->value = (int)c->value;
+    }
+    else if(conv == 's')
+    {
+        c->kind = ARG_STRING;
+        //NULL prints as "(null)"; glibc prints nothing instead when the precision is under 6, so not with one
+        c->string = strings[rnd(4)];
+        if(!hasPrecision && rnd(8) == 0) c->string = NULL;
+    }
+    else c->value = ' ' + rnd(95);
+
+    *p++ = conv;
+    if(rnd(2)) *p++ = '|';
+    *p = 0;
+}
+
+static int run(SnprintfFn fn, char *buf, size_t size, const Case *c)
+{
+    int a = c->stars[0], b = c->stars[1];
+
+    switch(c->kind * 3 + c->starCount)
+    {
+        case ARG_INT * 3 + 0: return fn(buf, size, c->fmt, (int)c->value);
+        case ARG_INT * 3 + 1: return fn(buf, size, c->fmt, a, (int)c->value);
+        case ARG_INT * 3 + 2: return fn(buf, size, c->fmt, a, b, (int)c->value);
+        case ARG_LLONG * 3 + 0: return fn(buf, size, c->fmt, c->value);
+        case ARG_LLONG * 3 + 1: return fn(buf, size, c->fmt, a, c->value);
+        case ARG_LLONG * 3 + 2: return fn(buf, size, c->fmt, a, b, c->value);
+        case ARG_STRING * 3 + 0: return fn(buf, size, c->fmt, c->string);
+        case ARG_STRING * 3 + 1: return fn(buf, size, c->fmt, a, c->string);
+        default: return fn(buf, size, c->fmt, a, b, c->string);
+    }
+}
+
+static double nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+//Workloads shaped like the boot log and error screen lines
+static u32 bench(SnprintfFn fn, u32 workload, u32 iterations)
+{
+    char buf[BUF_SIZE];
+    u32 total = 0;
+
+    for(u32 i = 0; i < iterations; i++)
+    {
+        u32 x = i * 2654435761u;
+
+        switch(workload)
+        {
+            case 0: total += (u32)fn(buf, sizeof(buf), "%u", x); break;
+            case 1: total += (u32)fn(buf, sizeof(buf), "0x%08x", x); break;
+            case 2: total += (u32)fn(buf, sizeof(buf), "stage %s %llu\n", "read", (unsigned long long)x * 40503u); break;
+            default:
+                total += (u32)fn(buf, sizeof(buf), "sdmmc errors=%u retries=%u clock=%u last_error=0x%x last_cmd=0x%x\n",
+                                 x & 3, x & 7, 16756991u, x, x >> 16);
+                break;
+        }
+    }
+
+    return total;
+}
+
+int main(int argc, char **argv)
+{
+    u32 cases = 200000, seed = 1, iterations = 500000;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "-n") == 0 && i + 1 < argc) cases = (u32)strtoul(argv[++i], NULL, 0);
+        else if(strcmp(argv[i], "-s") == 0 && i + 1 < argc) seed = (u32)strtoul(argv[++i], NULL, 0);
+        else if(strcmp(argv[i], "-b") == 0 && i + 1 < argc) iterations = (u32)strtoul(argv[++i], NULL, 0);
+        else
+        {
+            fprintf(stderr, "usage: %s [-n cases] [-s seed] [-b iterations]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    rngState = seed;
+    u32 mismatches = 0, truncated = 0;
+
+    for(u32 n = 0; n < cases; n++)
+    {
+        Case c;
+        makeCase(&c);
+
+        //Mostly large enough, sometimes cut short or empty
+        size_t size = rnd(3) == 0 ? rnd(40) : BUF_SIZE;
+        char expected[BUF_SIZE], actual[BUF_SIZE];
+        memset(expected, 0xAA, sizeof(expected));
+        memset(actual, 0xAA, sizeof(actual));
+
+        int expectedLen = run(snprintf, expected, size, &c), actualLen = run(fmtSnprintf, actual, size, &c);
+        if(expectedLen >= 0 && (size_t)expectedLen >= size) truncated++;
+
+        if(expectedLen != actualLen || memcmp(expected, actual, sizeof(expected)) != 0)
+        {
+            if(mismatches++ < 10)
+                printf("case %u: \"%s\" size %zu: libc %d \"%.*s\", fmt %d \"%.*s\"\n", n, c.fmt, size,
+                       expectedLen, (int)(size ? size - 1 : 0), expected, actualLen, (int)(size ? size - 1 : 0), actual);
+        }
+    }
+
+    printf("fmtcheck:  %u cases (%u truncated), %u mismatches\n", cases, truncated, mismatches);
+
+    static const char *workloads[] = { "%u", "0x%08x", "stage %s %llu", "sdmmc line" };
+    for(u32 i = 0; i < 4 && iterations != 0; i++)
+    {
+        double start = nowNs();
+        u32 fmtTotal = bench(fmtSnprintf, i, iterations);
+        double fmtNs = (nowNs() - start) / iterations;
+
+        start = nowNs();
+        u32 libcTotal = bench(snprintf, i, iterations);
+        double libcNs = (nowNs() - start) / iterations;
+
+        printf("%-14s fmt %6.1f ns, libc %6.1f ns per call (host)%s\n", workloads[i], fmtNs, libcNs,
+               fmtTotal == libcTotal ? "" : ", LENGTHS DIFFER");
+        if(fmtTotal != libcTotal) mismatches++;
+    }
+
+    return mismatches != 0;
+}
@@ -0,0 +1,211 @@
+/*
+*   Runs the chainloader's mount, payload scan and payload read against a
+*   disk image and reports where the time and the SD commands went.
+*
+*   usage: loadbench image [-n runs] [-w] [-f blocks] [-s KiB]
+*     -n runs    number of timed payload reads (default 5)
+*     -w         open the image writable and append the boot log to it
+*     -f blocks  inject a CRC error every that many blocks (loadbench_tmio)
+*     -s KiB     also stream the payload in chunks of that size and check it
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sdmmc_image.h"
+#include "fs.h"
+#include "firm.h"
+#include "trace.h"
+#include "utils.h"
+#include "lz4.h"
+#include "fatfs/sdmmc/sdmmc.h"
+
+//Rough SD bus cost model, so command count changes show up as time: fixed per-command
+//overhead (command/response, card access latency) plus data clocked out on the bus
+#define MODEL_CMD_OVERHEAD_US   50ULL
+
+static double ticksToMs(u64 ticks)
+{
+    return (double)ticks * 1000.0 / (double)TICKS_PER_SEC;
+}
+
+//FNV-1a, so runs with different backends or injected faults can be compared
+static u32 checksum(const u8 *buf, u32 size)
+{
+    u32 hash = 2166136261u;
+    for(u32 i = 0; i < size; i++) hash = (hash ^ buf[i]) * 16777619u;
+    return hash;
+}
+
+static u32 readLe32(const u8 *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((u32)p[3] << 24);
+}
+
+//Decodes the sections of an LZ4 packed FIRM as the chainloader would. The header is parsed by hand,
+//Firm holds pointers and doesn't have the on-disk layout on a 64-bit host.
+static void decodePackedFirm(const u8 *payload, u32 size)
+{
+    if(size <= 0x200 || memcmp(payload, "FIRM", 4) != 0 || (payload[0x10] & FIRM_FLAG_LZ4) == 0) return;
+
+    u32 hash = 2166136261u, packedTotal = 0, decodedTotal = 0;
+    u64 ticks = 0;
+
+    for(u32 i = 0; i < 4; i++)
+    {
+        const u8 *entry = payload + 0x40 + 0x30 * i;
+        u32 offset = readLe32(entry), sectionSize = readLe32(entry + 8), packedSize = readLe32(payload + 0x20 + 4 * i);
+
+        if(offset > size || packedSize > size - offset) error("section %u is outside the payload", i);
+
+        u8 *section = malloc(sectionSize + 1);
+        if(section == NULL) error("out of memory");
+
+        u64 startTicks = timerTicks();
+        u32 decoded = lz4Decompress(section, sectionSize, payload + offset, packedSize);
+        ticks += timerTicks() - startTicks;
+        if(decoded != sectionSize) error("section %u: decoded %u of %u bytes", i, decoded, sectionSize);
+
+        for(u32 j = 0; j < sectionSize; j++) hash = (hash ^ section[j]) * 16777619u;
+        packedTotal += packedSize;
+        decodedTotal += sectionSize;
+        free(section);
+    }
+
+    printf("lz4:       %u -> %u bytes, %.3f ms, %.1f MiB/s (host), fnv1a %08x\n", packedTotal, decodedTotal,
+           ticksToMs(ticks), ticks ? (double)decodedTotal / (1 << 20) / (ticksToMs(ticks) / 1000.0) : 0.0, hash);
+}
+
+static double modelledSdMs(u32 commands, u32 sectors)
+{
+    u64 busBits = (u64)sectors * 512 * 8 / sdmmc_sdcard_buswidth();
+    return (double)commands * MODEL_CMD_OVERHEAD_US / 1000.0 + (double)busBits * 1000.0 / sdmmc_sdcard_clock();
+}
+
+int main(int argc, char **argv)
+{
+    const char *imagePath = NULL;
+    u32 runs = 5;
+    bool writeLog = false;
+    u32 streamChunk = 0;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "-n") == 0 && i + 1 < argc) runs = (u32)strtoul(argv[++i], NULL, 0);
+        else if(strcmp(argv[i], "-w") == 0) writeLog = true;
+        else if(strcmp(argv[i], "-f") == 0 && i + 1 < argc) sdmmcImageSetFaults((u32)strtoul(argv[++i], NULL, 0));
+        else if(strcmp(argv[i], "-s") == 0 && i + 1 < argc) streamChunk = (u32)strtoul(argv[++i], NULL, 0) * 1024;
+        else if(imagePath == NULL) imagePath = argv[i];
+        else imagePath = NULL, i = argc;
+    }
+
+    if(imagePath == NULL || runs == 0)
+    {
+        fprintf(stderr, "usage: %s image [-n runs] [-w] [-f blocks] [-s KiB]\n", argv[0]);
+        return 2;
+    }
+
+    if(!sdmmcImageOpen(imagePath, writeLog)) error("cannot open %s", imagePath);
+
+    traceStage(STAGE_START);
+
+    if(!mountSdCardPartition()) error("SD mount error");
+
+    char path[10 + 255];
+    if(!payloadMenu(path)) error("no payload found");
+
+    u32 size = fileRead(NULL, path, 0);
+    u8 *buf = malloc(size);
+    if(buf == NULL) error("out of memory");
+
+    const sdmmcstats *stats = sdmmc_get_stats();
+    u32 commandsBefore = stats->commands,
+        sectorsBefore = bootTrace.sectorsRead,
+        readCallsBefore = bootTrace.readCalls;
+    u64 bestTicks = ~0ULL, totalTicks = 0;
+
+    sdmmcImageResetStats();
+
+    for(u32 i = 0; i < runs; i++)
+    {
+        if(fileRead(buf, path, size) != size) error("failed to read %s", path);
+        if(i == 0) traceStage(STAGE_READ);
+
+        totalTicks += bootTrace.lastReadTicks;
+        if(bootTrace.lastReadTicks < bestTicks) bestTicks = bootTrace.lastReadTicks;
+    }
+
+    u32 commands = (stats->commands - commandsBefore) / runs,
+        sectors = (bootTrace.sectorsRead - sectorsBefore) / runs,
+        readCalls = (bootTrace.readCalls - readCallsBefore) / runs;
+
+    printf("payload:   %s, %u bytes, fnv1a %08x\n", path, size, checksum(buf, size));
+    printf("mount:     %.3f ms\n", ticksToMs(traceStageTicks(STAGE_MOUNT)));
+    printf("scan:      %.3f ms\n", ticksToMs(traceStageTicks(STAGE_SCAN)));
+    printf("read:      best %.3f ms, avg %.3f ms, %.1f MiB/s (host)\n", ticksToMs(bestTicks), ticksToMs(totalTicks / runs),
+           bestTicks ? (double)size / (1 << 20) / (ticksToMs(bestTicks) / 1000.0) : 0.0);
+    printf("per read:  %u disk_read calls, %u sectors, %u SD commands\n", readCalls, sectors, commands);
+    printf("modelled:  %.3f ms on a %u kHz %u-bit bus\n", modelledSdMs(commands, sectors),
+           sdmmc_sdcard_clock() / 1000, sdmmc_sdcard_buswidth());
+    printf("boot io:   %u reads / %u sectors, %u writes / %u sectors, %u commands, %u errors\n",
+           bootTrace.readCalls, bootTrace.sectorsRead, bootTrace.writeCalls, bootTrace.sectorsWritten,
+           stats->commands, stats->errors);
+    if(stats->errors != 0)
+        printf("recovery:  %u retries, %u re-inits, %u clock step-downs, now %u kHz\n",
+               stats->retries, stats->reinits, stats->slowdowns, sdmmc_sdcard_clock() / 1000);
+    sdmmcImagePrintStats();
+    decodePackedFirm(buf, size);
+
+    //Scatter read at unaligned offsets, as FIRM sections are read when the payload exceeds the staging window
+    if(size >= 0x1000)
+    {
+        u8 *copy = malloc(size);
+        if(copy == NULL) error("out of memory");
+
+        u32 split1 = 0x3FF, split2 = size / 2 + 7;
+        FileExtent extents[3] = {
+            { copy + split2, split2, size - split2 },
+            { copy, 0, split1 },
+            { copy + split1, split1, split2 - split1 },
+        };
+        u32 readCallsBefore = bootTrace.readCalls;
+
+        if(!fileReadExtents(path, extents, 3)) error("failed to scatter read %s", path);
+        printf("scatter:   3 extents, %u disk_read calls, %s\n", bootTrace.readCalls - readCallsBefore,
+               memcmp(copy, buf, size) == 0 ? "match" : "MISMATCH");
+        free(copy);
+    }
+
+    if(streamChunk != 0)
+    {
+        u8 *chunkBufs = malloc(2 * streamChunk);
+        if(chunkBufs == NULL) error("out of memory");
+
+        FileStream stream;
+        u32 readCallsBefore = bootTrace.readCalls, streamed = 0, chunks = 0, hash = 2166136261u, chunkSize;
+        u64 startTicks = timerTicks();
+
+        if(!fileStreamOpen(&stream, path, chunkBufs, chunkBufs + streamChunk, streamChunk)) error("cannot stream %s", path);
+        for(const u8 *chunk; (chunk = fileStreamNext(&stream, &chunkSize)) != NULL; chunks++, streamed += chunkSize)
+            for(u32 i = 0; i < chunkSize; i++) hash = (hash ^ chunk[i]) * 16777619u;
+        if(!fileStreamClose(&stream) || streamed != size) error("failed to stream %s", path);
+
+        printf("stream:    %u chunks of %u KiB, %u disk_read calls, %.3f ms, fnv1a %08x (%s)\n", chunks,
+               streamChunk / 1024, bootTrace.readCalls - readCallsBefore, ticksToMs(timerTicks() - startTicks), hash,
+               hash == checksum(buf, size) ? "match" : "MISMATCH");
+        free(chunkBufs);
+    }
+
+    if(writeLog)
+    {
+        traceStage(STAGE_LAUNCH);
+        writeBootLog();
+        printf("log write: %u writes / %u sectors, %u cached rewrites\n",
+               bootTrace.writeCalls, bootTrace.sectorsWritten, bootTrace.writeCacheHits);
+    }
+
+    free(buf);
+    sdmmcImageClose();
+
+    return 0;
+}
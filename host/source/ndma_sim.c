@@ -0,0 +1,202 @@
+/*
+*   Host-side model of the ARM9 NDMA channel registers and of the data
+*   cache as the transfers see it, for running the real ndma.c off device.
+*   A transfer moves its data in one go, a fixed number of CNT polls after
+*   it was started.
+*
+*   The ARM946 data cache is write-back and allocates on reads only, so the
+*   model keeps two bits per 32-byte line of the arena: cached and dirty.
+*   A transfer reading dirty lines or writing over dirty ones, and a CPU
+*   read of a line that was cached while a transfer wrote it, count as
+*   violations of the cleaning protocol.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "ndma_sim.h"
+#include "ndma.h"
+#include "cache.h"
+
+#define SIM_TRANSFER_LATENCY    8   //CNT polls until a transfer completes
+
+#define LINE_CACHED     1
+#define LINE_DIRTY      2
+#define LINE_STALE      4   //cached while a transfer wrote the memory
+
+static u8 *arena;
+static u32 arenaStart, arenaSize;
+static u8 lines[(64u << 20) / 32];
+
+static u32 regs[(NDMA_CHANNEL(NDMA_CHANNELS)) / 4];
+static u32 countdown[NDMA_CHANNELS];
+static u32 violations;
+
+static struct
+{
+    u64 transfers, words, polls, cleaned, invalidated;
+} simStats;
+
+static u32 toAddress(const void *p)
+{
+    return (u32)(uintptr_t)p;
+}
+
+static u8 *at(u32 address)
+{
+    return arena + (address - arenaStart);
+}
+
+static bool inArena(u32 address, u32 size)
+{
+    return address >= arenaStart && size <= arenaSize && address - arenaStart <= arenaSize - size;
+}
+
+static void violation(const char *what, u32 address, u32 size)
+{
+    violations++;
+    printf("ndma_sim: %s, 0x%08x+0x%x\n", what, address, size);
+}
+
+//Loops over the state of every line touching [address, address + size) inside the arena
+#define FOR_LINES(address, size, line) \
+    for(u32 line_ = ((address) - arenaStart) / 32, end_ = ((address) - arenaStart + (size) + 31) / 32; line_ < end_; line_++) \
+        for(u8 *line = &lines[line_]; line != NULL; line = NULL)
+
+static bool anyLine(u32 address, u32 size, u8 mask)
+{
+    FOR_LINES(address, size, line)
+        if(*line & mask) return true;
+    return false;
+}
+
+static void complete(u32 channel)
+{
+    u32 base = NDMA_CHANNEL(channel), cnt = regs[(base + NDMA_CNT) / 4],
+        dst = regs[(base + NDMA_DAD) / 4], words = regs[(base + NDMA_WCNT) / 4];
+
+    if((cnt & (3u << 13)) == NDMA_SRC_FILL)
+        for(u32 i = 0; i < words; i++) memcpy(at(dst + 4 * i), &regs[(base + NDMA_FDATA) / 4], 4);
+    else
+        memcpy(at(dst), at(regs[(base + NDMA_SAD) / 4]), 4 * words);
+
+    FOR_LINES(dst, 4 * words, line)
+        if(*line & LINE_CACHED) *line |= LINE_STALE;
+
+    regs[(base + NDMA_CNT) / 4] &= ~NDMA_ENABLE;
+    simStats.words += words;
+}
+
+static void startTransfer(u32 channel, u32 cnt)
+{
+    u32 base = NDMA_CHANNEL(channel),
+        src = regs[(base + NDMA_SAD) / 4], dst = regs[(base + NDMA_DAD) / 4], words = regs[(base + NDMA_WCNT) / 4];
+    bool isFill = (cnt & (3u << 13)) == NDMA_SRC_FILL;
+
+    if((cnt & NDMA_IMMEDIATE_MODE) == 0 || words == 0 || (words & ((1u << (cnt >> 16 & 0xF)) - 1)) != 0)
+        violation("bad immediate mode setup", dst, 4 * words);
+    if(!inArena(dst, 4 * words) || (!isFill && !inArena(src, 4 * words)))
+    {
+        violation("transfer outside the arena", dst, 4 * words);
+        regs[(base + NDMA_CNT) / 4] = cnt & ~NDMA_ENABLE;
+        return;
+    }
+
+    if(!isFill && anyLine(src, 4 * words, LINE_DIRTY)) violation("source not cleaned", src, 4 * words);
+    if(anyLine(dst, 4 * words, LINE_DIRTY)) violation("dirty lines over the destination", dst, 4 * words);
+
+    countdown[channel] = SIM_TRANSFER_LATENCY;
+    simStats.transfers++;
+}
+
+u32 ndma_hook_read32(u32 reg)
+{
+    u32 channel = (reg - NDMA_CHANNEL(0)) / 0x1C;
+
+    if(reg >= NDMA_CHANNEL(0) && (reg - NDMA_CHANNEL(channel)) == NDMA_CNT && (regs[reg / 4] & NDMA_ENABLE))
+    {
+        simStats.polls++;
+        if(--countdown[channel] == 0) complete(channel);
+    }
+
+    return regs[reg / 4];
+}
+
+void ndma_hook_write32(u32 reg, u32 val)
+{
+    u32 channel = (reg - NDMA_CHANNEL(0)) / 0x1C;
+    bool isStart = reg >= NDMA_CHANNEL(0) && (reg - NDMA_CHANNEL(channel)) == NDMA_CNT &&
+                   (val & NDMA_ENABLE) && !(regs[reg / 4] & NDMA_ENABLE);
+
+    if(reg >= NDMA_CHANNEL(0) && (regs[(NDMA_CHANNEL(channel) + NDMA_CNT) / 4] & NDMA_ENABLE))
+        violation("channel written while busy", reg, 4);
+
+    regs[reg / 4] = val;
+    if(isStart) startTransfer(channel, val);
+}
+
+void cleanDCacheRange(const void *start, u32 size)
+{
+    u32 address = toAddress(start);
+
+    simStats.cleaned += size;
+    if(!inArena(address, size)) return;
+    FOR_LINES(address, size, line) *line &= ~LINE_DIRTY;
+}
+
+void flushDCacheRange(const void *start, u32 size)
+{
+    u32 address = toAddress(start);
+
+    simStats.cleaned += size;
+    if(!inArena(address, size)) return;
+    FOR_LINES(address, size, line) *line = 0;
+}
+
+void invalidateDCacheRange(const void *start, u32 size)
+{
+    u32 address = toAddress(start);
+
+    simStats.invalidated += size;
+    if(!inArena(address, size)) return;
+    //Dirty data in partial lines would be lost on hardware
+    if(anyLine(address, size, LINE_DIRTY)) violation("invalidating dirty lines", address, size);
+    FOR_LINES(address, size, line) *line = 0;
+}
+
+void ndmaSimInit(u8 *base, u32 size)
+{
+    arena = base;
+    arenaStart = toAddress(base);
+    arenaSize = size < sizeof(lines) * 32 ? size : sizeof(lines) * 32;
+    memset(lines, 0, sizeof(lines));
+}
+
+void ndmaSimCpuWrote(const void *p, u32 size)
+{
+    u32 address = toAddress(p);
+
+    if(size == 0 || !inArena(address, size)) return;
+    FOR_LINES(address, size, line)
+        if(*line & LINE_CACHED) *line |= LINE_DIRTY;
+}
+
+void ndmaSimCpuRead(const void *p, u32 size)
+{
+    u32 address = toAddress(p);
+
+    if(size == 0 || !inArena(address, size)) return;
+    if(anyLine(address, size, LINE_STALE)) violation("read of stale cached data", address, size);
+    FOR_LINES(address, size, line) *line = (*line & ~LINE_STALE) | LINE_CACHED;
+}
+
+u32 ndmaSimViolations(void)
+{
+    return violations;
+}
+
+void ndmaSimPrintStats(void)
+{
+    printf("ndma_sim:  %llu transfers, %llu words, %llu CNT polls, %llu bytes cleaned, %llu invalidated\n",
+           (unsigned long long)simStats.transfers, (unsigned long long)simStats.words, (unsigned long long)simStats.polls,
+           (unsigned long long)simStats.cleaned, (unsigned long long)simStats.invalidated);
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "types.h"
+
+//Memory the model moves data in and tracks cache lines for; it has to sit below 4 GiB
+void ndmaSimInit(u8 *arena, u32 size);
+
+//CPU accesses, as far as the data cache sees them: writes dirty cached lines, reads allocate lines
+void ndmaSimCpuWrote(const void *p, u32 size);
+void ndmaSimCpuRead(const void *p, u32 size);
+
+//Cache protocol violations seen so far, each reported on stdout
+u32 ndmaSimViolations(void);
+void ndmaSimPrintStats(void);
@@ -0,0 +1,284 @@
+/*
+*   Runs the FIRM load planner (firmplan.c) on random section layouts and
+*   checks the result by carrying the plan out on a simulated address space:
+*   every section must arrive intact and nothing reserved may be touched.
+*   The same layouts copied in header order show what the planning avoids.
+*   memRangeContains, which decides which sections of a large payload are
+*   read straight to their load address, is checked against 64-bit math,
+*   including sections at and past the end of the staging window. Sections
+*   are checked against the memory the header check reserves; an ARM11 image
+*   at 0x1FF80000, as most payloads have, must be accepted.
+*
+*   usage: planfuzz [-n layouts] [-s seed]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "firmplan.h"
+#include "lz4.h"
+
+#define ARENA_BASE      0x100000u
+#define ARENA_SIZE      0x40000u
+#define RESERVED_START  (ARENA_BASE + ARENA_SIZE - 0x4000)
+#define MAX_SECTION     0x4000u
+
+static u8 arena[ARENA_SIZE], fill[ARENA_SIZE];
+static u64 rngState;
+
+static u32 rnd(u32 n)
+{
+    rngState = rngState * 6364136223846793005ULL + 1442695040888963407ULL;
+    return n ? (u32)(rngState >> 33) % n : 0;
+}
+
+static u8 *at(u32 address)
+{
+    return arena + (address - ARENA_BASE);
+}
+
+static void putLength(u8 *block, u32 *pos, u32 n)
+{
+    for(; n >= 255; n -= 255) block[(*pos)++] = 255;
+    block[(*pos)++] = (u8)n;
+}
+
+// Random data with repeats, together with an LZ4 block that encodes it. Returns the block size.
+static u32 makeBlock(u8 *data, u8 *block, u32 size)
+{
+    u32 pos = 0, blockPos = 0;
+
+    while(pos < size)
+    {
+        u32 lit = rnd(20), match = 4 + rnd(40);
+
+        if(pos + lit == 0) lit = 1;
+        if(pos + lit + match > size) lit = size - pos, match = 0;
+
+        block[blockPos++] = (u8)((lit < 15 ? lit : 15) << 4 | (match == 0 ? 0 : (match - 4 < 15 ? match - 4 : 15)));
+        if(lit >= 15) putLength(block, &blockPos, lit - 15);
+        for(u32 i = 0; i < lit; i++) block[blockPos++] = data[pos++] = (u8)rnd(256);
+
+        if(match == 0) break;
+
+        u32 offset = 1 + rnd(pos < 0xFFFF ? pos : 0xFFFF);
+        block[blockPos++] = offset & 0xFF;
+        block[blockPos++] = offset >> 8;
+        if(match - 4 >= 15) putLength(block, &blockPos, match - 4 - 15);
+        for(u32 i = 0; i < match; i++, pos++) data[pos] = data[pos - offset];
+    }
+
+    return blockPos;
+}
+
+static void runStep(const PlanStep *step)
+{
+    if(step->op == PLAN_LZ4) lz4Decompress(at(step->dst), step->size, at(step->src), step->srcSize);
+    else memmove(at(step->dst), at(step->src), step->size);
+}
+
+//The direct read window of firm.c: FCRAM up to the end of the staging area
+static u32 checkContains(void)
+{
+    const MemRange window = { 0x20000000, 0x27FFE000 };
+    static const u32 edges[] = { 0, 1, 0x1000, 0x1FFFFFFF, 0x20000000, 0x27FFDFFF, 0x27FFE000, 0x27FFE001,
+                                 0x28000000, 0xFFFFF000, 0xFFFFFFFF };
+    u32 failures = 0;
+
+    for(u32 n = 0; n < 200000; n++)
+    {
+        u32 start = n < 121 ? edges[n / 11] : (rnd(2) ? edges[rnd(11)] + rnd(0x4000) - 0x2000 : rnd(0xFFFFFFFF)),
+            size = n < 121 ? edges[n % 11] : (rnd(2) ? rnd(0x10000) : rnd(0xFFFFFFFF));
+        bool expected = start >= window.start && (u64)start + size <= window.end && start < window.end;
+
+        if(memRangeContains(window, start, size) != expected && failures++ < 10)
+            printf("memRangeContains: 0x%x+0x%x should be %s\n", start, size, expected ? "inside" : "outside");
+    }
+
+    return failures;
+}
+
+//Sections as checkFirmHeader sees them, against the reserved ranges redone in 64 bits
+static u32 checkReserved(void)
+{
+    static const struct
+    {
+        u32 address, size;
+        bool isAllowed;
+    } cases[] = {
+        { 0x1FF80000, 0x20000, true },   //this repo's ARM11 image, over the operation mailbox
+        { 0x1FF80000, 0x7FC00, true },   //all of AXI WRAM up to the firmlaunch stub
+        { 0x1FF80000, 0x7FC01, false },
+        { 0x1FFFFFFC, 4, false },        //the ARM11 entry word
+        { 0x20000000, 0x1000, true },
+        { 0x01FF7000, 0x1000, true },
+        { 0x01FFA000, 0x100, false },    //the chainloader's ITCM slice
+        { 0x08006000, 0x100000, true },
+        { 0xFFFFF000, 0x1000, false },   //ends at 4 GiB, which wraps to 0
+        { 0xFFFFF000, 0x2000, false },
+    };
+    u32 failures = 0;
+
+    for(u32 n = 0; n < 200000; n++)
+    {
+        u32 address, size;
+        bool expected;
+
+        if(n < sizeof(cases) / sizeof(cases[0]))
+        {
+            address = cases[n].address;
+            size = cases[n].size;
+            expected = cases[n].isAllowed;
+        }
+        else
+        {
+            const MemRange *near = &firmReservedRanges[rnd(FIRM_RESERVED_COUNT)];
+
+            address = rnd(2) ? near->start + rnd(0x2000) - 0x1000 : rnd(0xFFFFFFFF);
+            size = rnd(2) ? rnd(0x2000) : rnd(0xFFFFFFFF);
+            expected = (u64)address + size <= 0xFFFFFFFFULL;
+            for(u32 i = 0; i < FIRM_RESERVED_COUNT; i++)
+                if(size != 0 && address < firmReservedRanges[i].end && firmReservedRanges[i].start < (u64)address + size)
+                    expected = false;
+        }
+
+        if(firmSectionAllowed(address, size) != expected && failures++ < 10)
+            printf("firmSectionAllowed: 0x%x+0x%x should be %s\n", address, size, expected ? "accepted" : "rejected");
+    }
+
+    return failures;
+}
+
+static bool rangeOverlaps(u32 start1, u32 size1, u32 start2, u32 size2)
+{
+    return size1 != 0 && size2 != 0 && start1 < start2 + size2 && start2 < start1 + size1;
+}
+
+int main(int argc, char **argv)
+{
+    u32 layouts = 20000, seed = 1;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "-n") == 0 && i + 1 < argc) layouts = (u32)strtoul(argv[++i], NULL, 0);
+        else if(strcmp(argv[i], "-s") == 0 && i + 1 < argc) seed = (u32)strtoul(argv[++i], NULL, 0);
+        else
+        {
+            fprintf(stderr, "usage: %s [-n layouts] [-s seed]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    rngState = seed;
+    u32 containFailures = checkContains(), reservedFailures = checkReserved();
+    for(u32 i = 0; i < ARENA_SIZE; i++) fill[i] = (u8)rnd(256);
+
+    static u8 expected[4][MAX_SECTION], stored[4][MAX_SECTION * 2];
+    const MemRange reserved = { RESERVED_START, ARENA_BASE + ARENA_SIZE };
+    const MemRange window = { ARENA_BASE, RESERVED_START };
+    u32 planned = 0, noRoom = 0, bounced = 0, inPlace = 0, naiveBroken = 0, failures = 0;
+
+    for(u32 n = 0; n < layouts; n++)
+    {
+        PlanSection sections[4];
+        u32 count = 1 + rnd(4), fileSize = 0x200;
+        bool isPacked = rnd(2) != 0;
+
+        //Stored data laid out after a header, with random gaps, like a FIRM file
+        for(u32 i = 0; i < count; i++)
+        {
+            sections[i].size = rnd(8) == 0 ? 0 : 1 + rnd(MAX_SECTION);
+            sections[i].isPacked = isPacked;
+            if(isPacked) sections[i].srcSize = makeBlock(expected[i], stored[i], sections[i].size);
+            else
+            {
+                for(u32 j = 0; j < sections[i].size; j++) expected[i][j] = stored[i][j] = (u8)rnd(256);
+                sections[i].srcSize = sections[i].size;
+            }
+            fileSize += rnd(0x400);
+            sections[i].src = fileSize;
+            fileSize += sections[i].srcSize;
+        }
+
+        u32 fileStart = ARENA_BASE + rnd(RESERVED_START - ARENA_BASE - fileSize);
+        for(u32 i = 0; i < count; i++) sections[i].src += fileStart;
+
+        //Destinations: disjoint and clear of the reserved range, often on top of the file
+        bool isValid = true;
+        for(u32 i = 0; i < count && isValid; i++)
+        {
+            u32 tries = 0;
+            do
+            {
+                if(rnd(2) != 0 && fileStart > ARENA_BASE + sections[i].size)
+                    sections[i].dst = fileStart - sections[i].size + rnd(fileSize + sections[i].size);
+                else
+                    sections[i].dst = ARENA_BASE + rnd(ARENA_SIZE - sections[i].size);
+
+                isValid = sections[i].dst + sections[i].size <= RESERVED_START;
+                for(u32 j = 0; j < i && isValid; j++)
+                    if(rangeOverlaps(sections[i].dst, sections[i].size, sections[j].dst, sections[j].size)) isValid = false;
+            }
+            while(!isValid && ++tries < 100);
+        }
+        if(!isValid) continue;
+
+        FirmLoadPlan plan;
+        if(!planSectionLoads(&plan, sections, count, window, &reserved, 1))
+        {
+            noRoom++;
+            continue;
+        }
+        planned++;
+
+        u32 loads = 0;
+        for(u32 i = 0; i < count; i++) loads += sections[i].size != 0;
+        if(plan.count > loads) bounced++;
+        for(u32 i = 0; i < count; i++)
+            if(sections[i].size != 0 && rangeOverlaps(sections[i].dst, sections[i].size, fileStart, fileSize)) { inPlace++; break; }
+
+        //Planned order
+        memcpy(arena, fill, ARENA_SIZE);
+        for(u32 i = 0; i < count; i++) memcpy(at(sections[i].src), stored[i], sections[i].srcSize);
+        for(u32 i = 0; i < plan.count; i++)
+        {
+            if(rangeOverlaps(plan.steps[i].dst, plan.steps[i].size, reserved.start, reserved.end - reserved.start) ||
+               plan.steps[i].dst < ARENA_BASE || plan.steps[i].dst + plan.steps[i].size > ARENA_BASE + ARENA_SIZE)
+            {
+                printf("layout %u: step %u writes outside the allowed memory\n", n, i);
+                return 1;
+            }
+            runStep(&plan.steps[i]);
+        }
+
+        bool isBroken = memcmp(at(reserved.start), fill + (reserved.start - ARENA_BASE), reserved.end - reserved.start) != 0;
+        for(u32 i = 0; i < count; i++)
+            if(memcmp(at(sections[i].dst), expected[i], sections[i].size) != 0) isBroken = true;
+        if(isBroken)
+        {
+            failures++;
+            printf("layout %u: %u sections, %s, file at 0x%x+0x%x, plan of %u steps is wrong\n", n, count,
+                   isPacked ? "packed" : "plain", fileStart, fileSize, plan.count);
+        }
+
+        //Header order, as the chainloader used to copy
+        memcpy(arena, fill, ARENA_SIZE);
+        for(u32 i = 0; i < count; i++) memcpy(at(sections[i].src), stored[i], sections[i].srcSize);
+        for(u32 i = 0; i < count; i++)
+        {
+            if(sections[i].size == 0) continue;
+            PlanStep step = { isPacked ? PLAN_LZ4 : PLAN_COPY, sections[i].dst, sections[i].size, sections[i].src, sections[i].srcSize };
+            runStep(&step);
+        }
+        for(u32 i = 0; i < count; i++)
+            if(memcmp(at(sections[i].dst), expected[i], sections[i].size) != 0) { naiveBroken++; break; }
+    }
+
+    printf("planfuzz:  %u layouts planned, %u without bounce room, %u over the file, %u with bounce copies\n",
+           planned, noRoom, inPlace, bounced);
+    printf("header order would have broken %u of them, the plans broke %u\n", naiveBroken, failures);
+    printf("direct read window: %u wrong memRangeContains results\n", containFailures);
+    printf("reserved memory: %u wrong firmSectionAllowed results\n", reservedFailures);
+
+    return failures != 0 || containFailures != 0 || reservedFailures != 0;
+}
@@ -0,0 +1,131 @@
+/*
+*   Host stand-in for sdmmc.c: serves sectors from a disk image file and
+*   counts the commands the real driver would have issued.
+*/
+
+#include <stdio.h>
+#include "sdmmc_image.h"
+#include "fatfs/sdmmc/sdmmc.h"
+
+static FILE *image;
+static bool imageWritable;
+static u32 imageSectors;
+static sdmmcstats stats;
+
+bool sdmmcImageOpen(const char *path, bool writable)
+{
+    image = fopen(path, writable ? "r+b" : "rb");
+    if(image == NULL) return false;
+
+    fseeko(image, 0, SEEK_END);
+    imageSectors = (u32)(ftello(image) / 512);
+    imageWritable = writable;
+
+    return true;
+}
+
+void sdmmcImageClose(void)
+{
+    if(image != NULL) fclose(image);
+    image = NULL;
+}
+
+static int imageError(u32 cmd)
+{
+    stats.errors++;
+    stats.lasterror = 4;
+    stats.lastcmd = (u16)cmd;
+    return 1;
+}
+
+u32 sdmmc_sdcard_init()
+{
+    return image != NULL ? 0 : 2;
+}
+
+int sdmmc_sdcard_readsectors(u32 sector_no, u32 numsectors, u8 *out)
+{
+    stats.commands++;
+
+    if(sector_no + numsectors > imageSectors || sector_no + numsectors < sector_no) return imageError(0x33C12);
+
+    fseeko(image, (off_t)sector_no * 512, SEEK_SET);
+    return fread(out, 512, numsectors, image) == numsectors ? 0 : imageError(0x33C12);
+}
+
+//Image reads complete immediately, the result is held until the wait
+static int asyncResult;
+
+void sdmmc_sdcard_readsectors_start(u32 sector_no, u32 numsectors, u8 *out)
+{
+    asyncResult = sdmmc_sdcard_readsectors(sector_no, numsectors, out);
+}
+
+int sdmmc_sdcard_readsectors_wait(void)
+{
+    return asyncResult;
+}
+
+int sdmmc_sdcard_writesectors(u32 sector_no, u32 numsectors, const u8 *in)
+{
+    stats.commands++;
+
+    if(sector_no + numsectors > imageSectors || sector_no + numsectors < sector_no) return imageError(0x52C19);
+
+    fseeko(image, (off_t)sector_no * 512, SEEK_SET);
+    return fwrite(in, 512, numsectors, image) == numsectors ? 0 : imageError(0x52C19);
+}
+
+bool sdmmc_sdcard_writable(void)
+{
+    return imageWritable;
+}
+
+const sdmmcstats *sdmmc_get_stats(void)
+{
+    return &stats;
+}
+
+//Report what SD_Init() negotiates on hardware: HCLK/4, 4-bit
+u32 sdmmc_sdcard_clock(void)
+{
+    return SDMMC_CLOCK / 4;
+}
+
+u32 sdmmc_sdcard_buswidth(void)
+{
+    return 4;
+}
+
+u32 sdmmc_sdcard_sectors(void)
+{
+    return imageSectors;
+}
+
+//4 MiB, what SDHC cards commonly report
+u32 sdmmc_sdcard_ausize(void)
+{
+    return 8192;
+}
+
+//Erased data reads back as zeros or ones depending on the card, so the image is left as is
+int sdmmc_sdcard_erase(u32 start, u32 end)
+{
+    stats.commands += 3;
+
+    return end < start || end >= imageSectors ? imageError(0x10526) : 0;
+}
+
+//Errors are only modelled at the register level, this backend has no driver to recover
+void sdmmcImageSetFaults(u32 interval)
+{
+    (void)interval;
+}
+
+void sdmmcImageResetStats(void)
+{
+}
+
+void sdmmcImagePrintStats(void)
+{
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "types.h"
+
+bool sdmmcImageOpen(const char *path, bool writable);
+void sdmmcImageSetFaults(u32 interval); //CRC error every interval-th block (0: never), loadbench_tmio only
+void sdmmcImageClose(void);
+
+//Counters of the register level model (loadbench_tmio); no-ops for the plain image backend
+void sdmmcImageResetStats(void);
+void sdmmcImagePrintStats(void);
@@ -0,0 +1,194 @@
+/*
+*   Times the multi-pattern search (patternSetSearch in memory.c) on a large
+*   synthetic image against one pass per pattern with the former memsearch,
+*   which built its table on every call. Small images with short and
+*   repetitive patterns are checked match by match against a plain scan.
+*
+*   usage: searchbench [-m MiB] [-p patterns] [-s seed]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "memory.h"
+
+#define MAX_PLANTED 64
+
+static u64 rngState;
+
+static u32 rnd(u32 n)
+{
+    rngState = rngState * 6364136223846793005ULL + 1442695040888963407ULL;
+    return n ? (u32)(rngState >> 33) % n : 0;
+}
+
+static double nowMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+//The previous memsearch, one table of 256 words per call
+static u8 *oldMemsearch(u8 *startPos, const void *pattern, u32 size, u32 patternSize)
+{
+    const u8 *patternc = (const u8 *)pattern;
+    u32 table[256];
+
+    for(u32 i = 0; i < 256; i++)
+        table[i] = patternSize;
+    for(u32 i = 0; i < patternSize - 1; i++)
+        table[patternc[i]] = patternSize - i - 1;
+
+    if(size < patternSize) return NULL;
+
+    u32 j = 0;
+    while(j <= size - patternSize)
+    {
+        u8 c = startPos[j + patternSize - 1];
+        if(patternc[patternSize - 1] == c && memcmp(pattern, startPos + j, patternSize - 1) == 0)
+            return startPos + j;
+        j += table[c];
+    }
+
+    return NULL;
+}
+
+//First match of any pattern at or after from, the earliest pattern winning ties
+static u8 *plainSearch(u8 *data, u32 size, u32 from, const u8 *const *patterns, const u32 *sizes, u32 count, u32 *index)
+{
+    for(u32 j = from; j < size; j++)
+        for(u32 i = 0; i < count; i++)
+            if(sizes[i] <= size - j && memcmp(data + j, patterns[i], sizes[i]) == 0)
+            {
+                *index = i;
+                return data + j;
+            }
+
+    return NULL;
+}
+
+//Every match in small images with short, overlapping and repetitive patterns, against the plain scan
+static u32 checkSmallImages(void)
+{
+    static u8 data[0x2000], patternData[PATTERN_SET_MAX][300];
+    const u8 *patterns[PATTERN_SET_MAX];
+    u32 sizes[PATTERN_SET_MAX], failures = 0;
+
+    for(u32 n = 0; n < 300; n++)
+    {
+        u32 size = 1 + rnd(sizeof(data)), count = 1 + rnd(PATTERN_SET_MAX), alphabet = 2 + rnd(255);
+
+        for(u32 i = 0; i < size; i++) data[i] = (u8)rnd(alphabet);
+        for(u32 i = 0; i < count; i++)
+        {
+            sizes[i] = 1 + (rnd(4) == 0 ? rnd(300) : rnd(8));
+            for(u32 j = 0; j < sizes[i]; j++) patternData[i][j] = (u8)rnd(alphabet);
+            patterns[i] = patternData[i];
+            if(sizes[i] <= size) memcpy(data + rnd(size - sizes[i] + 1), patternData[i], sizes[i]);
+        }
+
+        PatternSet set;
+        if(!patternSetInit(&set, (const void *const *)patterns, sizes, count)) return failures + 1;
+
+        for(u32 from = 0;;)
+        {
+            u32 index = 0, expectedIndex = 0;
+            u8 *expected = plainSearch(data, size, from, patterns, sizes, count, &expectedIndex),
+               *pos = patternSetSearch(&set, data + from, size - from, &index);
+
+            if(pos != expected || (pos != NULL && index != expectedIndex))
+            {
+                if(failures++ < 10)
+                    printf("image %u: match at %d (pattern %u), expected %d (pattern %u)\n", n, pos ? (int)(pos - data) : -1,
+                           index, expected ? (int)(expected - data) : -1, expectedIndex);
+                break;
+            }
+            if(pos == NULL) break;
+
+            from = (u32)(pos - data) + 1;
+        }
+    }
+
+    return failures;
+}
+
+int main(int argc, char **argv)
+{
+    u32 mib = 64, count = 4, seed = 1;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "-m") == 0 && i + 1 < argc) mib = (u32)strtoul(argv[++i], NULL, 0);
+        else if(strcmp(argv[i], "-p") == 0 && i + 1 < argc) count = (u32)strtoul(argv[++i], NULL, 0);
+        else if(strcmp(argv[i], "-s") == 0 && i + 1 < argc) seed = (u32)strtoul(argv[++i], NULL, 0);
+        else
+        {
+            fprintf(stderr, "usage: %s [-m MiB] [-p patterns] [-s seed]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if(mib == 0 || count == 0 || count > PATTERN_SET_MAX)
+    {
+        fprintf(stderr, "1 to %u patterns in at least 1 MiB\n", PATTERN_SET_MAX);
+        return 2;
+    }
+
+    rngState = seed;
+    u32 size = mib << 20;
+    u8 *image = malloc(size);
+    if(image == NULL) return 1;
+
+    //Code-like data: a small alphabet with repeats, so short shifts and false candidates both happen
+    for(u32 i = 0; i < size; i++)
+        image[i] = rnd(4) == 0 && i >= 64 ? image[i - 1 - rnd(64)] : (u8)(rnd(2) ? rnd(16) : rnd(256));
+
+    static u8 patternData[PATTERN_SET_MAX][64];
+    const u8 *patterns[PATTERN_SET_MAX];
+    u32 sizes[PATTERN_SET_MAX];
+
+    for(u32 i = 0; i < count; i++)
+    {
+        sizes[i] = 4 + rnd(29);
+        for(u32 j = 0; j < sizes[i]; j++) patternData[i][j] = (u8)rnd(256);
+        patterns[i] = patternData[i];
+
+        for(u32 k = 0; k < MAX_PLANTED / count; k++)
+            memcpy(image + rnd(size - sizes[i]), patternData[i], sizes[i]);
+    }
+
+    //All matches in one pass over the image
+    PatternSet set;
+    if(!patternSetInit(&set, (const void *const *)patterns, sizes, count)) return 1;
+
+    u32 setMatches = 0, failures = checkSmallImages(), index;
+    double start = nowMs();
+
+    for(u8 *pos = image; (pos = patternSetSearch(&set, pos, size - (u32)(pos - image), &index)) != NULL; pos++)
+        setMatches++;
+
+    double setMs = nowMs() - start;
+
+    //One pass per pattern with the previous search
+    u32 oldMatches = 0;
+    start = nowMs();
+
+    for(u32 i = 0; i < count; i++)
+        for(u8 *pos = image; (pos = oldMemsearch(pos, patterns[i], size - (u32)(pos - image), sizes[i])) != NULL; pos++)
+            oldMatches++;
+
+    double oldMs = nowMs() - start;
+
+    if(setMatches != oldMatches) failures++;
+
+    printf("searchbench: %u MiB, %u patterns, %u matches (%u one at a time), %u wrong\n", mib, count, setMatches,
+           oldMatches, failures);
+    printf("one pass:    %.1f ms, %.0f MiB/s (host)\n", setMs, setMs > 0 ? mib / (setMs / 1000.0) : 0.0);
+    printf("per pattern: %.1f ms, %.0f MiB/s (host)\n", oldMs, oldMs > 0 ? mib / (oldMs / 1000.0) : 0.0);
+
+    free(image);
+
+    return failures != 0;
+}
@@ -0,0 +1,150 @@
+/*
+*   Host replacements for the ARM9 modules that touch MMIO: timers, HID,
+*   I2C/MCU, the ARM11 screen interface and the final jump to the payload.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "types.h"
+#include "utils.h"
+#include "screen.h"
+#include "buttons.h"
+#include "i2c.h"
+#include "chainloader.h"
+
+u32 hostHidPad;
+
+static u8 topFb[SCREEN_TOP_FBSIZE], bottomFb[SCREEN_BOTTOM_FBSIZE];
+
+struct fb fbs[2] =
+{
+    { .top_left = topFb, .top_right = topFb, .bottom = bottomFb },
+    { .top_left = topFb, .top_right = topFb, .bottom = bottomFb },
+};
+
+bool needToSetupScreens = true;
+
+void timerInit(void)
+{
+}
+
+//Host monotonic clock, scaled to the ARM9 timer rate so the trace code is unchanged
+u64 timerTicks(void)
+{
+    static u64 base = 0;
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    u64 ticks = (u64)ts.tv_sec * TICKS_PER_SEC + (u64)ts.tv_nsec * TICKS_PER_SEC / 1000000000ULL;
+    if(base == 0) base = ticks;
+
+    return ticks - base;
+}
+
+//Nothing to wait out: the disk image and the TMIO model answer in polls, not time
+void timerWaitUntil(u64 deadline)
+{
+    (void)deadline;
+}
+
+void timerWaitUs(u64 us)
+{
+    (void)us;
+}
+
+void timerWaitMs(u64 ms)
+{
+    (void)ms;
+}
+
+//The menu always picks the highlighted entry
+u32 waitInput(bool isMenu)
+{
+    (void)isMenu;
+    return BUTTON_A;
+}
+
+void wait(u64 amount)
+{
+    (void)amount;
+}
+
+void error(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    fputs("error: ", stderr);
+    vfprintf(stderr, fmt, args);
+    fputc('\n', stderr);
+    va_end(args);
+
+    exit(1);
+}
+
+void mcuSetInfoLedPattern(u8 r, u8 g, u8 b, u32 periodMs, bool smooth)
+{
+    (void)r; (void)g; (void)b; (void)periodMs; (void)smooth;
+}
+
+void initScreens(void)
+{
+}
+
+void prepareArm11ForFirmlaunch(void)
+{
+}
+
+void chainload(int argc, char **argv, const FirmLoadPlan *plan)
+{
+    (void)argc; (void)argv; (void)plan;
+    exit(0);
+}
+
+void I2C_init(void)
+{
+}
+
+//Transfers complete inside the calls below, so there is never anything queued
+void I2C_flush(void)
+{
+}
+
+//MCU RTC (register 0x30) reads back as 2026-01-01 12:00:00, everything else as zero
+bool I2C_readRegBuf(I2cDevice devId, u8 regAddr, u8 *out, u32 size)
+{
+    static const u8 rtc[8] = {0x00, 0x00, 0x12, 0x04, 0x01, 0x01, 0x26, 0x00};
+
+    for(u32 i = 0; i < size; i++)
+        out[i] = devId == I2C_DEV_MCU && regAddr == 0x30 && i < sizeof(rtc) ? rtc[i] : 0;
+
+    return true;
+}
+
+void I2C_readRegBufAsync(I2cTransfer *transfer, I2cDevice devId, u8 regAddr, u8 *out, u32 size)
+{
+    transfer->status = I2C_readRegBuf(devId, regAddr, out, size) ? I2C_DONE : I2C_FAILED;
+}
+
+bool I2C_wait(I2cTransfer *transfer)
+{
+    return transfer->status == I2C_DONE;
+}
+
+bool I2C_writeRegBuf(I2cDevice devId, u8 regAddr, const u8 *in, u32 size)
+{
+    (void)devId; (void)regAddr; (void)in; (void)size;
+    return true;
+}
+
+u8 I2C_readReg(I2cDevice devId, u8 regAddr)
+{
+    u8 data;
+    I2C_readRegBuf(devId, regAddr, &data, 1);
+    return data;
+}
+
+bool I2C_writeReg(I2cDevice devId, u8 regAddr, u8 data)
+{
+    return I2C_writeRegBuf(devId, regAddr, &data, 1);
+}
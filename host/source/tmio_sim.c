@@ -0,0 +1,365 @@
+/*
+*   Host-side model of the TMIO SD host controller register file and its
+*   32-bit FIFO, backed by a disk image, for running the real sdmmc.c off
+*   device. It emulates an SDHC card far enough for SD_Init() and the
+*   CMD18/CMD25 transfers, and counts register accesses and status polls.
+*
+*   Latencies are expressed in status polls (reads of REG_SDSTATUS1 or
+*   REG_DATACTL32) rather than time, so runs are exactly repeatable.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sdmmc_image.h"
+#include "fatfs/sdmmc/sdmmc.h"
+
+#define SIM_CMD_LATENCY     4   //polls until a command response arrives
+#define SIM_BLOCK_LATENCY   16  //polls until the next data block is ready
+#define SIM_ACMD41_RETRIES  2   //card reports busy for this many ACMD41s
+
+#define DATACTL32_RX32RDY   0x100
+#define DATACTL32_TX32BUSY  0x200
+
+#define CARD_RCA            0x0001
+#define CARD_STATUS_TRAN    0x900 //READY_FOR_DATA, state tran
+#define CARD_AU_SIZE        9     //4 MiB
+
+static FILE *image;
+static bool imageWritable;
+static u32 imageSectors;
+
+static u16 regs[0x200 / 2];
+static u16 stat0, stat1;
+static u16 ctl32;
+
+static u32 cmdCountdown;
+static bool cmdPending;
+static u16 pendingStat0;
+
+static struct
+{
+    bool active, isRead, sdStatus;
+    u32 sector, blocksLeft, countdown, wordPos, blockWords;
+    u32 buf[128];
+} xfer;
+
+static u32 acmd41Count;
+static bool nextIsAcmd;
+
+//Injected CRC errors, only while the bus runs at HCLK/4 or faster
+static u32 faultInterval, blocksUntilFault;
+
+static struct
+{
+    u64 reads, writes, fifoWords, polls, commands, sectors, faults;
+} simStats;
+
+static inline u16 *reg16(u16 reg)
+{
+    return &regs[(reg & 0x1FF) >> 1];
+}
+
+static void setResponse32(u32 resp)
+{
+    *reg16(REG_SDRESP0) = resp & 0xFFFF;
+    *reg16(REG_SDRESP1) = resp >> 16;
+}
+
+//R2 responses hold bits 127:8 of the CID/CSD, byte i being bits 8i+15:8i+8
+static void setResponse128(const u8 *bytes)
+{
+    for(u32 i = 0; i < 8; i++)
+        *reg16(REG_SDRESP0 + 2 * i) = bytes[2 * i] | (bytes[2 * i + 1] << 8);
+}
+
+static void buildCsd(u8 *csd)
+{
+    u32 cSize = imageSectors / 1024 - 1;
+
+    memset(csd, 0, 16);
+    csd[14] = 0x40; //CSD_STRUCTURE = 1 (SDHC/SDXC)
+    csd[11] = 0x32; //TRAN_SPEED = 25 MHz
+    csd[9] = 9;     //READ_BL_LEN = 512
+    csd[7] = (cSize >> 16) & 0x3F;
+    csd[6] = (cSize >> 8) & 0xFF;
+    csd[5] = cSize & 0xFF;
+}
+
+static void loadBlock(void)
+{
+    if(xfer.sdStatus)
+    {
+        memset(xfer.buf, 0, 64);
+        ((u8 *)xfer.buf)[10] = CARD_AU_SIZE << 4;
+    }
+    else
+    {
+        fseeko(image, (off_t)xfer.sector * 512, SEEK_SET);
+        if(fread(xfer.buf, 512, 1, image) != 1) memset(xfer.buf, 0, 512);
+    }
+    xfer.wordPos = 0;
+    ctl32 |= DATACTL32_RX32RDY;
+    stat1 |= TMIO_STAT1_RXRDY;
+}
+
+static void storeBlock(void)
+{
+    fseeko(image, (off_t)xfer.sector * 512, SEEK_SET);
+    fwrite(xfer.buf, 512, 1, image);
+}
+
+static void finishBlock(void)
+{
+    if(!xfer.sdStatus) simStats.sectors++;
+    xfer.sector++;
+    xfer.wordPos = 0;
+
+    if(--xfer.blocksLeft == 0)
+    {
+        xfer.active = false;
+        stat0 |= TMIO_STAT0_DATAEND;
+    }
+    else xfer.countdown = SIM_BLOCK_LATENCY;
+}
+
+static void startData(bool isRead, bool sdStatus, u32 arg)
+{
+    u32 count = *reg16(REG_SDBLKCOUNT);
+
+    if((!sdStatus && arg + count > imageSectors) || count == 0)
+    {
+        stat1 |= TMIO_STAT1_DATATIMEOUT;
+        return;
+    }
+
+    xfer.active = true;
+    xfer.isRead = isRead;
+    xfer.sdStatus = sdStatus;
+    xfer.blockWords = *reg16(REG_SDBLKLEN32) / 4;
+    xfer.sector = arg;
+    xfer.blocksLeft = count;
+    xfer.countdown = SIM_BLOCK_LATENCY;
+    xfer.wordPos = 0;
+
+    if(!isRead) ctl32 |= DATACTL32_TX32BUSY;
+}
+
+static void executeCommand(u16 cmd)
+{
+    u32 arg = *reg16(REG_SDCMDARG0) | (*reg16(REG_SDCMDARG1) << 16);
+    u32 index = cmd & 0x3F;
+    bool isAcmd = (cmd & 0x40) != 0 || nextIsAcmd;
+    u8 bytes[16];
+
+    simStats.commands++;
+    nextIsAcmd = false;
+    pendingStat0 = TMIO_STAT0_CMDRESPEND;
+
+    if(isAcmd)
+    {
+        switch(index)
+        {
+            case 41:
+                acmd41Count++;
+                setResponse32(acmd41Count > SIM_ACMD41_RETRIES ? 0xC0FF8000 : 0x00FF8000); //powered up, CCS
+                break;
+            case 6:
+                setResponse32(CARD_STATUS_TRAN | 0x20); //APP_CMD
+                break;
+            case 13:
+                setResponse32(CARD_STATUS_TRAN | 0x20);
+                startData(true, true, 0);
+                break;
+            default:
+                setResponse32(CARD_STATUS_TRAN);
+                break;
+        }
+    }
+    else
+    {
+        switch(index)
+        {
+            case 0:
+                acmd41Count = 0;
+                pendingStat0 = TMIO_STAT0_CMDRESPEND;
+                break;
+            case 12:
+                xfer.active = false;
+                setResponse32(CARD_STATUS_TRAN);
+                break;
+            case 2:
+                memset(bytes, 0x5A, sizeof(bytes));
+                setResponse128(bytes);
+                break;
+            case 3:
+                setResponse32(CARD_RCA << 16);
+                break;
+            case 8:
+                setResponse32(arg & 0xFFF); //echo voltage and check pattern
+                break;
+            case 9:
+                buildCsd(bytes);
+                setResponse128(bytes);
+                break;
+            case 55:
+                nextIsAcmd = true;
+                setResponse32(CARD_STATUS_TRAN | 0x20);
+                break;
+            case 18:
+            case 25:
+                setResponse32(CARD_STATUS_TRAN);
+                startData(index == 18, false, arg);
+                break;
+            default:
+                setResponse32(CARD_STATUS_TRAN);
+                break;
+        }
+    }
+
+    cmdPending = true;
+    cmdCountdown = SIM_CMD_LATENCY;
+}
+
+//Advances the model by one status poll
+static void poll(void)
+{
+    simStats.polls++;
+
+    if(cmdPending && --cmdCountdown == 0)
+    {
+        cmdPending = false;
+        stat0 |= pendingStat0;
+    }
+
+    if(!cmdPending && xfer.active && xfer.countdown != 0 && --xfer.countdown == 0)
+    {
+        if(xfer.isRead && !xfer.sdStatus && faultInterval != 0 && (*reg16(REG_SDCLKCTL) & 0xFF) <= 1 &&
+           --blocksUntilFault == 0)
+        {
+            blocksUntilFault = faultInterval;
+            simStats.faults++;
+            xfer.active = false;
+            stat1 |= TMIO_STAT1_CRCFAIL;
+        }
+        else if(xfer.isRead) loadBlock();
+        else ctl32 &= ~DATACTL32_TX32BUSY;
+    }
+}
+
+u16 sdmmc_hook_read16(u16 reg)
+{
+    simStats.reads++;
+
+    switch(reg)
+    {
+        case REG_SDSTATUS0:
+            //Card inserted, write protect switch reads as writable
+            return stat0 | TMIO_STAT0_SIGSTATE | (imageWritable ? TMIO_STAT0_WRPROTECT : 0);
+        case REG_SDSTATUS1:
+            poll();
+            return stat1 | (cmdPending ? TMIO_STAT1_CMD_BUSY : 0);
+        case REG_DATACTL32:
+            poll();
+            return (*reg16(reg) & ~(DATACTL32_RX32RDY | DATACTL32_TX32BUSY)) | ctl32;
+        default:
+            return *reg16(reg);
+    }
+}
+
+void sdmmc_hook_write16(u16 reg, u16 val)
+{
+    simStats.writes++;
+
+    switch(reg)
+    {
+        //Status bits are acknowledged by writing 0 to them
+        case REG_SDSTATUS0:
+            stat0 &= val;
+            break;
+        case REG_SDSTATUS1:
+            stat1 &= val;
+            break;
+        case REG_SDCMD:
+            *reg16(reg) = val;
+            executeCommand(val);
+            break;
+        default:
+            *reg16(reg) = val;
+            break;
+    }
+}
+
+u32 sdmmc_hook_read32(u16 reg)
+{
+    simStats.reads++;
+
+    if(reg != REG_SDFIFO32 || !xfer.active || !xfer.isRead || !(ctl32 & DATACTL32_RX32RDY)) return 0;
+
+    simStats.fifoWords++;
+    u32 data = xfer.buf[xfer.wordPos++];
+    if(xfer.wordPos == xfer.blockWords)
+    {
+        ctl32 &= ~DATACTL32_RX32RDY;
+        finishBlock();
+    }
+
+    return data;
+}
+
+void sdmmc_hook_write32(u16 reg, u32 val)
+{
+    simStats.writes++;
+
+    if(reg != REG_SDFIFO32 || !xfer.active || xfer.isRead || (ctl32 & DATACTL32_TX32BUSY)) return;
+
+    simStats.fifoWords++;
+    xfer.buf[xfer.wordPos++] = val;
+    if(xfer.wordPos == 128)
+    {
+        storeBlock();
+        ctl32 |= DATACTL32_TX32BUSY;
+        finishBlock();
+    }
+}
+
+bool sdmmcImageOpen(const char *path, bool writable)
+{
+    image = fopen(path, writable ? "r+b" : "rb");
+    if(image == NULL) return false;
+
+    fseeko(image, 0, SEEK_END);
+    imageSectors = (u32)(ftello(image) / 512);
+    imageWritable = writable;
+
+    return true;
+}
+
+void sdmmcImageClose(void)
+{
+    if(image != NULL) fclose(image);
+    image = NULL;
+}
+
+void sdmmcImageSetFaults(u32 interval)
+{
+    faultInterval = blocksUntilFault = interval;
+}
+
+void sdmmcImageResetStats(void)
+{
+    memset(&simStats, 0, sizeof(simStats));
+}
+
+void sdmmcImagePrintStats(void)
+{
+    double sectors = simStats.sectors ? (double)simStats.sectors : 1.0;
+
+    printf("tmio:      %llu commands, %llu sectors, %llu reg reads, %llu reg writes, %llu polls\n",
+           (unsigned long long)simStats.commands, (unsigned long long)simStats.sectors,
+           (unsigned long long)simStats.reads, (unsigned long long)simStats.writes, (unsigned long long)simStats.polls);
+    printf("per sect:  %.1f reg accesses (%.1f FIFO), %.1f polls\n",
+           (double)(simStats.reads + simStats.writes) / sectors, (double)simStats.fifoWords / sectors,
+           (double)simStats.polls / sectors);
+    if(faultInterval != 0) printf("faults:    %llu CRC errors injected\n", (unsigned long long)simStats.faults);
+}
@@ -0,0 +1,245 @@
+#!/usr/bin/env python3
+# Packs the sections of a FIRM payload as LZ4 blocks for the chainloader,
+# which decodes them straight to their load addresses. Packed payloads set
+# bit 1 of reserved2[0] and store each block's size at reserved2 + 0x10; the
+# section sizes and hashes still describe the decoded data.
+#
+# usage: firmlz4.py pack in.firm out.firm [--verify]
+#        firmlz4.py unpack in.firm out.firm
+#        firmlz4.py build out.firm [-9 entry] [-11 entry] address=file ...
+#
+# build makes a plain FIRM from raw files, e.g. to have something to pack on
+# the host. Every command prints the FNV-1a of the decoded sections, the same
+# value loadbench reports for a packed payload.
+
+import argparse
+import hashlib
+import struct
+import sys
+
+HEADER_SIZE = 0x200
+SECTION_ALIGN = 0x200
+SECTION_FMT = "<IIII32s"
+FLAG_LZ4 = 2
+PACKED_SIZES = 0x20  # reserved2 + 0x10
+
+MIN_MATCH = 4
+LAST_LITERALS = 5    # the format ends every block with at least 5 literals
+MATCH_LIMIT = 12     # and starts no match in its last 12 bytes
+MAX_OFFSET = 0xFFFF
+
+
+def fnv1a(chunks):
+    h = 2166136261
+    for data in chunks:
+        for b in data:
+            h = ((h ^ b) * 16777619) & 0xFFFFFFFF
+    return h
+
+
+def parse(firm):
+    if len(firm) < HEADER_SIZE or firm[:4] != b"FIRM":
+        sys.exit("not a FIRM file")
+    sections = []
+    for i in range(4):
+        offset, address, size, proc, digest = struct.unpack_from(SECTION_FMT, firm, 0x40 + 0x30 * i)
+        sections.append({"offset": offset, "address": address, "size": size, "proc": proc, "hash": digest})
+    return sections
+
+
+def packed_sizes(firm):
+    return struct.unpack_from("<4I", firm, PACKED_SIZES)
+
+
+def write_length(out, n):
+    while n >= 255:
+        out.append(255)
+        n -= 255
+    out.append(n)
+
+
+def emit(out, literals, match_len, offset):
+    lit = len(literals)
+    ml = match_len - MIN_MATCH if match_len else 0
+    out.append((min(lit, 15) << 4) | min(ml, 15))
+    if lit >= 15:
+        write_length(out, lit - 15)
+    out += literals
+    if match_len:
+        out += struct.pack("<H", offset)
+        if ml >= 15:
+            write_length(out, ml - 15)
+
+
+def compress(data):
+    """Greedy single-probe LZ4 block compressor, the same parse as the reference fast mode."""
+    out = bytearray()
+    n = len(data)
+    table = {}
+    anchor = pos = 0
+    limit = n - MATCH_LIMIT
+
+    while pos < limit:
+        key = data[pos:pos + MIN_MATCH]
+        cand = table.get(key, -1)
+        table[key] = pos
+        if cand < 0 or pos - cand > MAX_OFFSET:
+            pos += 1
+            continue
+
+        end = pos + MIN_MATCH
+        while end < n - LAST_LITERALS and data[end] == data[cand + end - pos]:
+            end += 1
+        # Extend backwards over literals that also match
+        while pos > anchor and cand > 0 and data[pos - 1] == data[cand - 1]:
+            pos -= 1
+            cand -= 1
+
+        emit(out, data[anchor:pos], end - pos, pos - cand)
+        for p in range(pos + 1, min(end, limit)):
+            table[data[p:p + MIN_MATCH]] = p
+        anchor = pos = end
+
+    emit(out, data[anchor:], 0, 0)
+    return bytes(out)
+
+
+def decompress(block, size):
+    out = bytearray()
+    i = 0
+    while i < len(block):
+        token = block[i]
+        i += 1
+        lit = token >> 4
+        if lit == 15:
+            while True:
+                b = block[i]
+                i += 1
+                lit += b
+                if b != 255:
+                    break
+        out += block[i:i + lit]
+        i += lit
+        if i == len(block):
+            break
+        offset = block[i] | block[i + 1] << 8
+        i += 2
+        ml = token & 15
+        if ml == 15:
+            while True:
+                b = block[i]
+                i += 1
+                ml += b
+                if b != 255:
+                    break
+        ml += MIN_MATCH
+        if offset == 0 or offset > len(out):
+            raise ValueError("bad match offset")
+        for _ in range(ml):
+            out.append(out[-offset])
+    if len(out) != size:
+        raise ValueError("decoded %d bytes, expected %d" % (len(out), size))
+    return bytes(out)
+
+
+def assemble(header, blobs, sizes, packed):
+    """Lays the section data out after the header; addresses, process types and hashes are kept."""
+    out = bytearray(header[:HEADER_SIZE])
+    for i, blob in enumerate(blobs):
+        entry = 0x40 + 0x30 * i
+        struct.pack_into("<I", out, entry, len(out) if blob else 0)
+        struct.pack_into("<I", out, entry + 8, sizes[i])
+        out += blob
+        out += bytes(-len(out) % SECTION_ALIGN)
+    if packed:
+        out[0x10] |= FLAG_LZ4
+    else:
+        out[0x10] &= ~FLAG_LZ4 & 0xFF
+    struct.pack_into("<4I", out, PACKED_SIZES, *[len(b) if packed else 0 for b in blobs])
+    return out
+
+
+def section_data(firm, sections):
+    if firm[0x10] & FLAG_LZ4:
+        sizes = packed_sizes(firm)
+        return [decompress(firm[s["offset"]:s["offset"] + sizes[i]], s["size"]) for i, s in enumerate(sections)]
+    return [firm[s["offset"]:s["offset"] + s["size"]] for s in sections]
+
+
+def cmd_pack(args):
+    firm = open(args.input, "rb").read()
+    sections = parse(firm)
+    if firm[0x10] & FLAG_LZ4:
+        sys.exit("%s is already packed" % args.input)
+    data = section_data(firm, sections)
+    blobs = [compress(d) if d else b"" for d in data]
+
+    out = assemble(firm, blobs, [len(d) for d in data], True)
+    for i, s in enumerate(sections):
+        if data[i]:
+            print("section %d: 0x%08x, %d -> %d bytes" % (i, s["address"], len(data[i]), len(blobs[i])))
+    print("payload: %d -> %d bytes, fnv1a %08x" % (len(firm), len(out), fnv1a(data)))
+
+    if args.verify:
+        check = section_data(out, parse(out))
+        if check != data:
+            sys.exit("verify: decoded sections differ")
+        print("verify: ok")
+
+    open(args.output, "wb").write(out)
+
+
+def cmd_unpack(args):
+    firm = open(args.input, "rb").read()
+    sections = parse(firm)
+    data = section_data(firm, sections)
+    out = assemble(firm, data, [len(d) for d in data], False)
+    print("payload: %d -> %d bytes, fnv1a %08x" % (len(firm), len(out), fnv1a(data)))
+    open(args.output, "wb").write(out)
+
+
+def cmd_build(args):
+    if not 1 <= len(args.sections) <= 4:
+        sys.exit("1 to 4 sections")
+    header = bytearray(HEADER_SIZE)
+    header[:4] = b"FIRM"
+    data = []
+    for i, spec in enumerate(args.sections):
+        addr, _, path = spec.partition("=")
+        d = open(path, "rb").read()
+        data.append(d)
+        struct.pack_into(SECTION_FMT, header, 0x40 + 0x30 * i, 0, int(addr, 0), len(d), 0, hashlib.sha256(d).digest())
+    first = struct.unpack_from("<I", header, 0x44)[0]
+    struct.pack_into("<II", header, 8, int(args.arm11, 0) if args.arm11 else first, int(args.arm9, 0) if args.arm9 else first)
+    data += [b""] * (4 - len(data))
+
+    out = assemble(header, data, [len(d) for d in data], False)
+    print("payload: %d bytes, fnv1a %08x" % (len(out), fnv1a(data)))
+    open(args.output, "wb").write(out)
+
+
+def main():
+    ap = argparse.ArgumentParser(description="LZ4 FIRM section packer")
+    sub = ap.add_subparsers(dest="cmd", required=True)
+    p = sub.add_parser("pack")
+    p.add_argument("input")
+    p.add_argument("output")
+    p.add_argument("--verify", action="store_true", help="decode the result again and compare")
+    p.set_defaults(func=cmd_pack)
+    p = sub.add_parser("unpack")
+    p.add_argument("input")
+    p.add_argument("output")
+    p.set_defaults(func=cmd_unpack)
+    p = sub.add_parser("build")
+    p.add_argument("output")
+    p.add_argument("-9", dest="arm9", help="ARM9 entry point (default: first section)")
+    p.add_argument("-11", dest="arm11", help="ARM11 entry point (default: first section)")
+    p.add_argument("sections", nargs="+", metavar="address=file")
+    p.set_defaults(func=cmd_build)
+
+    args = ap.parse_args()
+    args.func(args)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,373 @@
+#!/usr/bin/env python3
+# Builds a FAT32 or exFAT disk image (MBR + one partition, like a freshly
+# formatted SD card) for the host build. Files are written contiguously; on
+# FAT32 names that do not fit 8.3 get long file name entries, on exFAT files
+# and directories are marked NoFatChain as SDXC formatters do.
+#
+# usage: mkfatimg.py out.img [-x] [-s size_MiB] [-c cluster_KiB] path=source ...
+#   -x            exFAT instead of FAT32
+#   path=file     copies a host file to path in the image
+#   path=@4M      fills path with 4 MiB of pseudo-random data
+
+import argparse
+import random
+import struct
+import sys
+
+SECTOR = 512
+PART_START = 8192  # 4 MiB aligned, as the SD formatter does
+RESERVED = 32
+EOC = 0x0FFFFFFF
+DOS_DATE = ((2026 - 1980) << 9) | (1 << 5) | 1
+DOS_TIME = 12 << 11
+
+
+class Dir:
+    def __init__(self):
+        self.entries = {}  # name -> Dir or bytes
+        self.cluster = 0
+
+
+def parse_size(text):
+    mult = {"K": 1 << 10, "M": 1 << 20, "G": 1 << 30}
+    if text[-1].upper() in mult:
+        return int(text[:-1], 0) * mult[text[-1].upper()]
+    return int(text, 0)
+
+
+def short_name(name):
+    """Returns (8.3 name, NT case flags), or None if name needs a long name entry."""
+    base, _, ext = name.rpartition(".") if "." in name else (name, "", "")
+    if not base or len(base) > 8 or len(ext) > 3 or not (base + ext).replace("_", "").replace("-", "").isalnum():
+        return None
+    if base != base.lower() and base != base.upper() or ext != ext.lower() and ext != ext.upper():
+        return None
+    # NT reserved byte: 0x08 lowercase base, 0x10 lowercase extension
+    nt = (0x08 if base.islower() else 0) | (0x10 if ext.islower() else 0)
+    return (base.upper().ljust(8) + ext.upper().ljust(3)).encode("ascii"), nt
+
+
+def alias_name(name, index):
+    base, _, ext = name.rpartition(".") if "." in name else (name, "", "")
+    clean = lambda t: "".join(c for c in t.upper() if c.isalnum() or c in "_-")
+    tail = "~%d" % index
+    return (clean(base)[:8 - len(tail)] + tail).ljust(8).encode("ascii") + clean(ext)[:3].ljust(3).encode("ascii")
+
+
+def lfn_entries(name, name83):
+    csum = 0
+    for c in name83:
+        csum = (((csum & 1) << 7) + (csum >> 1) + c) & 0xFF
+    chars = list(name.encode("utf-16-le"))
+    units = [chars[i] | chars[i + 1] << 8 for i in range(0, len(chars), 2)]
+    count = (len(units) + 12) // 13
+    units += [0x0000] + [0xFFFF] * (count * 13 - len(units) - 1) if len(units) % 13 else []
+    entries = []
+    for seq in range(count, 0, -1):
+        part = units[(seq - 1) * 13:seq * 13]
+        entries.append(struct.pack("<B5HBBB6HH2H", seq | (0x40 if seq == count else 0), *part[0:5],
+                                   0x0F, 0, csum, *part[5:11], 0, *part[11:13]))
+    return entries
+
+
+def dir_entry(name83, attr, nt, cluster, size):
+    return struct.pack("<11sBBBHHHHHHHI", name83, attr, nt, 0, DOS_TIME, DOS_DATE, DOS_DATE,
+                       cluster >> 16, DOS_TIME, DOS_DATE, cluster & 0xFFFF, size)
+
+
+class Image:
+    def __init__(self, sectors, spc):
+        self.spc = spc
+        self.csize = spc * SECTOR
+        # Solve for the FAT size, which depends on the cluster count it has to describe
+        fatsz = 1
+        while True:
+            clusters = (sectors - RESERVED - 2 * fatsz) // spc
+            need = ((clusters + 2) * 4 + SECTOR - 1) // SECTOR
+            if need <= fatsz:
+                break
+            fatsz = need
+        if clusters < 65525:
+            sys.exit("image too small for FAT32 with this cluster size (%d clusters)" % clusters)
+        self.sectors = sectors
+        self.fatsz = fatsz
+        self.clusters = clusters
+        self.fat = [0] * (clusters + 2)
+        self.fat[0] = 0x0FFFFFF8
+        self.fat[1] = EOC
+        self.next_free = 2
+        self.data = {}  # cluster -> bytes
+
+    def alloc(self, size):
+        count = max(1, (size + self.csize - 1) // self.csize)
+        first = self.next_free
+        if first + count > self.clusters + 2:
+            sys.exit("image full")
+        for c in range(first, first + count - 1):
+            self.fat[c] = c + 1
+        self.fat[first + count - 1] = EOC
+        self.next_free += count
+        return first
+
+    def store(self, cluster, payload):
+        for i in range(0, max(len(payload), 1), self.csize):
+            self.data[cluster + i // self.csize] = payload[i:i + self.csize]
+
+    def place(self, node, parent_cluster, is_root):
+        # Allocate children first so their entries can reference them
+        entries = []
+        if not is_root:
+            entries.append(dir_entry(b".          ", 0x10, 0, node.cluster, 0))
+            entries.append(dir_entry(b"..         ", 0x10, 0, parent_cluster, 0))
+        aliases = 0
+        for name, child in sorted(node.entries.items()):
+            short = short_name(name)
+            if short is None:
+                aliases += 1
+                name83, nt = alias_name(name, aliases), 0
+                entries += lfn_entries(name, name83)
+            else:
+                name83, nt = short
+            if isinstance(child, Dir):
+                child.cluster = self.alloc(self.csize)
+                entries.append(dir_entry(name83, 0x10, nt, child.cluster, 0))
+            else:
+                cluster = self.alloc(len(child)) if child else 0
+                if child:
+                    self.store(cluster, child)
+                entries.append(dir_entry(name83, 0x20, nt, cluster, len(child)))
+        table = b"".join(entries)
+        if len(table) > self.csize:
+            sys.exit("too many entries in one directory")
+        self.store(node.cluster, table)
+        for child in node.entries.values():
+            if isinstance(child, Dir):
+                self.place(child, 0 if is_root else node.cluster, False)
+
+    def write(self, path, root):
+        root.cluster = self.alloc(self.csize)
+        self.place(root, 0, True)
+
+        part_sectors = self.sectors
+        total = PART_START + part_sectors
+        with open(path, "wb") as f:
+            f.truncate(total * SECTOR)
+
+            # MBR with a single FAT32 LBA partition
+            mbr = bytearray(SECTOR)
+            mbr[446:462] = struct.pack("<B3sB3sII", 0, b"\xfe\xff\xff", 0x0C, b"\xfe\xff\xff",
+                                       PART_START, part_sectors)
+            mbr[510:512] = b"\x55\xaa"
+            f.seek(0)
+            f.write(mbr)
+
+            vbr = bytearray(SECTOR)
+            vbr[0:3] = b"\xeb\x58\x90"
+            vbr[3:11] = b"MSWIN4.1"
+            struct.pack_into("<HBHBHHBHHHII", vbr, 11, SECTOR, self.spc, RESERVED, 2, 0, 0, 0xF8, 0,
+                             63, 255, PART_START, part_sectors)
+            struct.pack_into("<IHHIHH", vbr, 36, self.fatsz, 0, 0, root.cluster, 1, 6)
+            struct.pack_into("<BBBI11s8s", vbr, 64, 0x80, 0, 0x29, 0x12345678, b"NO NAME    ", b"FAT32   ")
+            vbr[510:512] = b"\x55\xaa"
+
+            fsinfo = bytearray(SECTOR)
+            struct.pack_into("<I", fsinfo, 0, 0x41615252)
+            struct.pack_into("<IIII", fsinfo, 484, 0x61417272, 0xFFFFFFFF, 0xFFFFFFFF, 0)
+            struct.pack_into("<I", fsinfo, 508, 0xAA550000)
+
+            base = PART_START * SECTOR
+            for copy in (0, 6):
+                f.seek(base + copy * SECTOR)
+                f.write(vbr)
+                f.write(fsinfo)
+
+            fat = struct.pack("<%dI" % len(self.fat), *self.fat)
+            for i in range(2):
+                f.seek(base + (RESERVED + i * self.fatsz) * SECTOR)
+                f.write(fat)
+
+            data_start = base + (RESERVED + 2 * self.fatsz) * SECTOR
+            for cluster, payload in sorted(self.data.items()):
+                f.seek(data_start + (cluster - 2) * self.csize)
+                f.write(payload)
+
+
+def exfat_hash(units):
+    h = 0
+    for u in units:
+        for b in (u & 0xFF, u >> 8):
+            h = (((h << 15) | (h >> 1)) + b) & 0xFFFF
+    return h
+
+
+def exfat_entry_set(name, attr, cluster, size, contiguous):
+    units = [ord(c) for c in name]
+    count = (len(units) + 14) // 15
+    ts = (DOS_DATE << 16) | DOS_TIME
+    primary = bytearray(struct.pack("<BBHHHIII", 0x85, 1 + count, 0, attr, 0, ts, ts, ts) + bytes(12))
+    flags = 0x01 | (0x02 if contiguous else 0)  # AllocationPossible, NoFatChain
+    stream = struct.pack("<BBBBHHQIIQ", 0xC0, flags, 0, len(units), exfat_hash([ord(c) for c in name.upper()]), 0,
+                         size, 0, cluster, size)
+    entries = [primary, stream]
+    for i in range(count):
+        part = units[i * 15:(i + 1) * 15]
+        entries.append(struct.pack("<BB15H", 0xC1, 0, *(part + [0] * (15 - len(part)))))
+    data = bytearray(b"".join(entries))
+    csum = 0
+    for i, b in enumerate(data):
+        if i in (2, 3):
+            continue
+        csum = (((csum << 15) | (csum >> 1)) + b) & 0xFFFF
+    struct.pack_into("<H", data, 2, csum)
+    return bytes(data)
+
+
+class ExfatImage:
+    def __init__(self, sectors, spc):
+        self.spc = spc
+        self.csize = spc * SECTOR
+        self.sectors = sectors
+        self.fat_offset = 2048  # 1 MiB aligned, like the SD formatter
+        clusters = (sectors - self.fat_offset) // spc
+        self.fat_length = ((clusters + 2) * 4 + SECTOR - 1) // SECTOR
+        self.heap_offset = (self.fat_offset + self.fat_length + 2047) // 2048 * 2048
+        self.clusters = (sectors - self.heap_offset) // spc
+        self.fat = {0: 0xFFFFFFF8, 1: 0xFFFFFFFF}
+        self.next_free = 2
+        self.data = {}
+
+    def alloc(self, size, chain):
+        count = max(1, (size + self.csize - 1) // self.csize)
+        first = self.next_free
+        if first + count > self.clusters + 2:
+            sys.exit("image full")
+        if chain:
+            for c in range(first, first + count - 1):
+                self.fat[c] = c + 1
+            self.fat[first + count - 1] = 0xFFFFFFFF
+        self.next_free += count
+        return first
+
+    def store(self, cluster, payload):
+        for i in range(0, max(len(payload), 1), self.csize):
+            self.data[cluster + i // self.csize] = payload[i:i + self.csize]
+
+    def place(self, node, entries):
+        for name, child in sorted(node.entries.items()):
+            if isinstance(child, Dir):
+                child.cluster = self.alloc(self.csize, False)
+                entries.append(exfat_entry_set(name, 0x10, child.cluster, self.csize, True))
+            else:
+                cluster = self.alloc(len(child), False) if child else 0
+                if child:
+                    self.store(cluster, child)
+                entries.append(exfat_entry_set(name, 0x20, cluster, len(child), True))
+        table = b"".join(entries)
+        if len(table) > self.csize:
+            sys.exit("too many entries in one directory")
+        self.store(node.cluster, table)
+        for child in node.entries.values():
+            if isinstance(child, Dir):
+                self.place(child, [])
+
+    def write(self, path, root):
+        # The allocation bitmap and the root directory are FAT chained, as FatFs requires
+        bitmap_size = (self.clusters + 7) // 8
+        bitmap_cluster = self.alloc(bitmap_size, True)
+        upcase = struct.pack("<128H", *[ord(chr(c).upper()) if c < 128 else c for c in range(128)])
+        upcase_cluster = self.alloc(len(upcase), True)
+        self.store(upcase_cluster, upcase)
+        root.cluster = self.alloc(self.csize, True)
+
+        upcase_sum = 0
+        for b in upcase:
+            upcase_sum = (((upcase_sum >> 1) | (upcase_sum << 31)) + b) & 0xFFFFFFFF
+        entries = [bytes([0x83]) + bytes(31),  # empty volume label
+                   struct.pack("<BB18sIQ", 0x81, 0, bytes(18), bitmap_cluster, bitmap_size),
+                   struct.pack("<B3sI12sIQ", 0x82, bytes(3), upcase_sum, bytes(12), upcase_cluster, len(upcase))]
+        self.place(root, entries)
+
+        bitmap = bytearray(bitmap_size)
+        for c in range(2, self.next_free):
+            bitmap[(c - 2) // 8] |= 1 << ((c - 2) % 8)
+        self.store(bitmap_cluster, bytes(bitmap))
+
+        total = PART_START + self.sectors
+        with open(path, "wb") as f:
+            f.truncate(total * SECTOR)
+
+            mbr = bytearray(SECTOR)
+            mbr[446:462] = struct.pack("<B3sB3sII", 0, b"\xfe\xff\xff", 0x07, b"\xfe\xff\xff",
+                                       PART_START, self.sectors)
+            mbr[510:512] = b"\x55\xaa"
+            f.write(mbr)
+
+            region = bytearray(12 * SECTOR)
+            vbr = memoryview(region)[0:SECTOR]
+            vbr[0:3] = b"\xeb\x76\x90"
+            vbr[3:11] = b"EXFAT   "
+            struct.pack_into("<QQIIIIIIHHBBBBB", vbr, 64, PART_START, self.sectors, self.fat_offset,
+                             self.fat_length, self.heap_offset, self.clusters, root.cluster, 0x12345678,
+                             0x0100, 0, 9, self.spc.bit_length() - 1, 1, 0x80, 0)
+            vbr[510:512] = b"\x55\xaa"
+            for i in range(1, 9):
+                struct.pack_into("<I", region, i * SECTOR + 508, 0xAA550000)
+            csum = 0
+            for i, b in enumerate(region[:11 * SECTOR]):
+                if i in (106, 107, 112):
+                    continue
+                csum = (((csum >> 1) | (csum << 31)) + b) & 0xFFFFFFFF
+            region[11 * SECTOR:] = struct.pack("<I", csum) * (SECTOR // 4)
+
+            base = PART_START * SECTOR
+            f.seek(base)
+            f.write(region)
+            f.write(region)
+
+            fat = bytearray(self.fat_length * SECTOR)
+            for c, v in self.fat.items():
+                struct.pack_into("<I", fat, c * 4, v)
+            f.seek(base + self.fat_offset * SECTOR)
+            f.write(fat)
+
+            heap = base + self.heap_offset * SECTOR
+            for cluster, payload in sorted(self.data.items()):
+                f.seek(heap + (cluster - 2) * self.csize)
+                f.write(payload)
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Build a FAT32 SD card image")
+    ap.add_argument("out")
+    ap.add_argument("-x", "--exfat", action="store_true", help="format as exFAT")
+    ap.add_argument("-s", "--size", type=int, default=512, help="partition size in MiB (default 512)")
+    ap.add_argument("-c", "--cluster", type=int, default=4, help="cluster size in KiB (default 4)")
+    ap.add_argument("files", nargs="*", metavar="path=source")
+    args = ap.parse_args()
+
+    spc = args.cluster * 1024 // SECTOR
+    if spc < 1 or spc > 128 or spc & (spc - 1):
+        sys.exit("cluster size must be a power of two between 1 and 64 KiB")
+
+    rng = random.Random(0x3D5)
+    root = Dir()
+    for spec in args.files:
+        path, _, source = spec.partition("=")
+        if not path or not source:
+            sys.exit("expected path=source, got '%s'" % spec)
+        if source.startswith("@"):
+            content = rng.randbytes(parse_size(source[1:]))
+        else:
+            with open(source, "rb") as f:
+                content = f.read()
+        parts = path.strip("/").split("/")
+        node = root
+        for part in parts[:-1]:
+            node = node.entries.setdefault(part, Dir())
+        node.entries[parts[-1]] = content
+
+    (ExfatImage if args.exfat else Image)(args.size * 2048, spc).write(args.out, root)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,102 @@
+#!/usr/bin/env python3
+# Summarizes the boot records appended to /luma/chainloader.log by a
+# BOOT_TRACE_LOG=1 build into a per-stage time breakdown.
+#
+# usage: parse_boot_log.py chainloader.log [-a]
+
+import sys
+
+STAGES = ["start", "sd_init", "mount", "scan", "menu", "read", "launch"]
+
+
+def parse(lines):
+    boots = []
+    cur = None
+    for line in lines:
+        words = line.split()
+        if not words:
+            continue
+        if words[0] == "boot":
+            cur = {"stages": {}, "io": {}, "sdmmc": {}, "payload_read": {}}
+        elif cur is None:
+            continue
+        elif words[0] == "stage" and len(words) == 3:
+            cur["stages"][words[1]] = int(words[2])
+        elif words[0] in ("io", "sdmmc", "payload_read"):
+            for kv in words[1:]:
+                k, _, v = kv.partition("=")
+                cur[words[0]][k] = int(v, 0)
+        elif words[0] == "end":
+            boots.append(cur)
+            cur = None
+    return boots
+
+
+def breakdown(boot):
+    # Each mark is the end of a stage; a stage lasts from the previous reached mark
+    res = []
+    prev = 0
+    for name in STAGES:
+        if name in boot["stages"]:
+            t = boot["stages"][name]
+            res.append((name, t - prev))
+            prev = t
+    return res, prev
+
+
+def print_boot(idx, boot):
+    stages, total = breakdown(boot)
+    print("boot #%d: %.3f ms total" % (idx, total / 1000))
+    for name, us in stages:
+        share = 100 * us / total if total else 0
+        print("  %-8s %10.3f ms  %5.1f%%" % (name, us / 1000, share))
+    io = boot["io"]
+    if io:
+        print("  io: %d reads / %d sectors, %d writes / %d sectors (%d cached rewrites), %d commands"
+              % (io.get("read_calls", 0), io.get("sectors_read", 0),
+                 io.get("write_calls", 0), io.get("sectors_written", 0),
+                 io.get("write_cache_hits", 0), io.get("commands", 0)))
+    read = boot["payload_read"]
+    if read.get("bytes"):
+        print("  payload read: %d KiB in %.3f ms, %d KiB/s"
+              % (read["bytes"] // 1024, read.get("us", 0) / 1000, read.get("kib_per_s", 0)))
+    sd = boot["sdmmc"]
+    if sd.get("errors"):
+        print("  sdmmc: %d errors, last error 0x%x (stat1 0x%x, cmd 0x%x)"
+              % (sd["errors"], sd.get("last_error", 0), sd.get("last_stat1", 0), sd.get("last_cmd", 0)))
+        print("  recovery: %d retries, %d re-inits, %d clock step-downs, ended at %d kHz"
+              % (sd.get("retries", 0), sd.get("reinits", 0), sd.get("slowdowns", 0), sd.get("clock", 0) // 1000))
+
+
+def print_summary(boots):
+    print("%d boots" % len(boots))
+    print("  %-8s %10s %10s %10s" % ("stage", "min ms", "avg ms", "max ms"))
+    for name in STAGES:
+        vals = [us for b in boots for n, us in breakdown(b)[0] if n == name]
+        if vals:
+            print("  %-8s %10.3f %10.3f %10.3f"
+                  % (name, min(vals) / 1000, sum(vals) / len(vals) / 1000, max(vals) / 1000))
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit("usage: %s chainloader.log [-a]" % sys.argv[0])
+
+    with open(sys.argv[1], "r", errors="replace") as f:
+        boots = parse(f)
+
+    if not boots:
+        sys.exit("no complete boot records found")
+
+    if "-a" in sys.argv[2:]:
+        for i, boot in enumerate(boots):
+            print_boot(i, boot)
+    else:
+        print_boot(len(boots) - 1, boots[-1])
+
+    if len(boots) > 1:
+        print_summary(boots)
+
+
+if __name__ == "__main__":
+    main()